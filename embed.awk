@@ -0,0 +1,45 @@
+#
+# CDDL HEADER START
+#
+# The contents of this file are subject to the terms of the
+# Common Development and Distribution License (the "License").
+# You may not use this file except in compliance with the License.
+#
+# You can obtain a copy of the license at CDDL.LICENSE.
+# See the License for the specific language governing permissions
+# and limitations under the License.
+#
+# When distributing Covered Code, include this CDDL HEADER in each
+# file and include the License file at CDDL.LICENSE.
+# If applicable, add the following below this CDDL HEADER, with the
+# fields enclosed by brackets "[]" replaced with your own identifying
+# information: Portions Copyright [yyyy] [name of copyright owner]
+#
+# CDDL HEADER END
+#
+
+#
+# This script reads viewer.html and replaces the <!-- SVG --> line with the
+# contents of the file named by the svg variable, an SVG file produced by
+# dot, minus the XML declaration and DOCTYPE which precede the <svg> element.
+#
+
+/<!-- SVG -->/ {
+	if (svg == "") {
+		exit 1;
+	}
+	insvg = 0;
+	while ((getline line < svg) > 0) {
+		if (line ~ /^<svg/)
+			insvg = 1;
+		if (insvg)
+			print line;
+	}
+	close(svg);
+	if (!insvg) {
+		exit 1;
+	}
+	next;
+}
+
+{ print }
@@ -28,9 +28,9 @@
 /*
  * Generate a dot file for the SMF dependency graph on this machine.
  *
- * We operate in two modes: with and without -L.  Without -L, we print nodes
- * for each instance and edges for each dependency.  Fortunately dot allows
- * forward references, so we can do this in one pass.  Options are
+ * We operate in two modes: with and without -L.  Without -L, we crawl the
+ * repository into an in-memory graph and print nodes for each instance and
+ * edges for each dependency.  Options are
  *
  *   -s width,height	Size, in inches, that the graph should be limited to.
  *
@@ -49,25 +49,116 @@
  *     consolidate_rpcbind_svcs  Consolidate services which only depend on
  *				network/inetd and rpc/bind into a single node.
  *
+ *     dedup_edges		Print only one edge for each dependency group
+ *				which names an instance more than once (e.g.,
+ *				directly and through its service).
+ *
+ *     merge_edges		Also merge edges from different dependency
+ *				groups to the same instance into one, labeled
+ *				with the groups' names.
+ *
+ *     rank_levels		Put instances on ranks by the longest chain of
+ *				require_* dependencies above them, so dot can
+ *				lay the graph out faster.  (See print_ranks().)
+ *
+ *     pin_milestones		Also give milestones ranks of their own, and
+ *				line them up.
+ *
+ *     compact			Print the colors of the nodes and the styles
+ *				of the edges once for each class, rather than
+ *				on every node and edge, so the file is smaller
+ *				and dot parses it faster.  (See
+ *				print_compact().)
+ *
+ *   -S			Print statistics about the graph on the standard
+ *			error.
+ *
+ *   -i index		Read the graph from index, as written by -I, instead of
+ *			crawling the repository.
+ *
+ *   -I index		Crawl the repository and save the graph to index
+ *			instead of printing it.
+ *
+ *   -q query		Answer query instead of printing the graph.  query
+ *			should be
+ *
+ *			    dependencies|dependents[*] fmri [groupings]
+ *
+ *			which prints the direct dependencies or dependents of
+ *			fmri, or with *, all of them, transitively.  groupings
+ *			is a comma-separated list of require_all, require_any,
+ *			optional_all, exclude_all, and restarter, and limits
+ *			the dependencies followed to those kinds.  If query is
+ *			"-", each line of the standard input is answered in
+ *			turn, followed by an empty line.  Use with -i so the
+ *			repository needn't be crawled each time.
+ *
+ *   -d fmri,...	Print the instances which would become unable to run
+ *			if the given instances were disabled, each followed by
+ *			the chain of dependencies responsible.  (See
+ *			sim_init().)  If the argument is "-", each line of the
+ *			standard input is a set of instances to try in turn,
+ *			and each answer is followed by an empty line.
+ *
+ *   -c index		Print a graph comparing the repository (or the -i
+ *			index) with the graph in index: instances and
+ *			dependencies which were added, removed, or changed
+ *			are highlighted and the rest faded.  The differences
+ *			are also listed on the standard error.
+ *
+ *   -D view		Print one level of the graph (see print_lod()): "/"
+ *			for an overview of the top-level groups of services, a
+ *			group such as "network/" for the groups and services
+ *			within it, or a service such as "network/physical" for
+ *			its instances.  Each group or service links to the
+ *			file of its own view.  "@" may be used instead of "/".
+ *
+ *   -u			With -i or -t, refresh whether each instance is enabled
+ *			and its state from the repository, without crawling
+ *			its dependencies again.  (See refresh().)  Instances
+ *			in maintenance or offline are drawn in red or purple.
+ *
+ *   -T log		Append the graph to the time-series log log instead of
+ *			printing it.  (See tlog_append().)
+ *
+ *   -k keyint		With -T, make every keyint-th record of the log a
+ *			full copy of the graph (default 16).
+ *
+ *   -t time		With -T, read the graph as of time from log instead of
+ *			crawling the repository.  time is in seconds since
+ *			the epoch or "YYYY-MM-DD [HH:MM[:SS]]".
+ *
+ *   -H dir		Write the data files for the HTML viewer, viewer.html,
+ *			to dir.  (See write_html_data() and the Makefile.)
+ *
+ *   -f filter		Crawl only the instances and dependency groups for
+ *			which filter is true, skipping the rest as early as
+ *			possible.  (See the grammar above filter_parse().)
+ *			With -S, also print how much of the repository was
+ *			skipped.
+ *
  * Other hard-coded graph settings (rankdir, nodesep, margin) were intended
  * for a 42" plotter.
  *
  * -L causes the program to print a dot file for use as a legend.  It
- * currently consists of eight nodes which demonstrate the color scheme and
- * the dependency types.  The nodes are enclosed in a box which is labeled
- * "legend".
+ * currently consists of ten nodes which demonstrate the color scheme (with
+ * instances in maintenance and offline) and the dependency types.  The nodes
+ * are enclosed in a box which is labeled "legend".
  */
 
 #include <sys/types.h>
 #include <sys/param.h>
+#include <sys/stat.h>
 #include <sys/utsname.h>
 #include <assert.h>
+#include <errno.h>
 #include <libscf.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <strings.h>
 #include <time.h>
 #include <unistd.h>
+#include <zlib.h>
 
 /* Private libscf function */
 extern int scf_parse_svc_fmri(char *fmri, const char **scope,
@@ -104,6 +195,40 @@ extern int scf_parse_svc_fmri(char *fmri, const char **scope,
 #define	LTGREEN		"#CDD5C0"
 #define	LTGRAY		"#F0F1F2"
 
+/*
+ * Instances which are in maintenance or offline get a red or purple
+ * foreground instead, since they're usually why a graph is being looked at.
+ */
+
+#define	MAINTFG		"#D7191C"
+#define	OFFLINEFG	"#7B3294"
+
+/*
+ * The state of an instance, as its restarter last recorded it.  ST_UNKNOWN
+ * covers instances without one and graphs from before states were recorded.
+ */
+typedef enum {
+	ST_UNKNOWN,
+	ST_UNINIT,
+	ST_OFFLINE,
+	ST_ONLINE,
+	ST_DEGRADED,
+	ST_MAINT,
+	ST_DISABLED
+} state_t;
+
+#define	NSTATES	(ST_DISABLED + 1)
+
+static const char * const state_names[NSTATES] = {
+	"",
+	"uninitialized",
+	"offline",
+	"online",
+	"degraded",
+	"maintenance",
+	"disabled"
+};
+
 static const struct coloring {
 	const char	*cat;
 	const char	*colors[2][2];
@@ -119,12 +244,22 @@ static const char * const x_opts[] = {
 	"omit_net_deps",
 	"consolidate_inetd_svcs",
 	"consolidate_rpcbind_svcs",
+	"dedup_edges",
+	"merge_edges",
+	"rank_levels",
+	"pin_milestones",
+	"compact",
 	NULL
 };
 
 static int omit_net_deps = 0;
 static int consolidate_inetd_svcs = 0;
 static int consolidate_rpcbind_svcs = 0;
+static int dedup_edges = 0;
+static int merge_edges = 0;
+static int rank_levels = 0;
+static int pin_milestones = 0;
+static int compact = 0;
 
 /* Consolidation strings */
 static char *inetd_svcs, *rpcbind_svcs;
@@ -248,12 +383,70 @@ get_restarter(scf_instance_t *i, char *buf, size_t bufsz)
 	}
 }
 
+/*
+ * Return the state_t of instance i, from its restarter property group.  Uses
+ * g_pg, g_prop, and g_val.
+ */
+static uint32_t
+get_state(scf_instance_t *i)
+{
+	char buf[32];
+	uint32_t st;
+
+	if (scf_instance_get_pg(i, SCF_PG_RESTARTER, g_pg) != 0) {
+		if (scf_error() != SCF_ERROR_NOT_FOUND)
+			scfdie();
+		return (ST_UNKNOWN);
+	}
+
+	if (scf_pg_get_property(g_pg, SCF_PROPERTY_STATE, g_prop) != 0) {
+		if (scf_error() != SCF_ERROR_NOT_FOUND)
+			scfdie();
+		return (ST_UNKNOWN);
+	}
+
+	if (scf_property_get_value(g_prop, g_val) != 0) {
+		switch (scf_error()) {
+		case SCF_ERROR_NOT_FOUND:
+		case SCF_ERROR_CONSTRAINT_VIOLATED:
+			return (ST_UNKNOWN);
+
+		default:
+			scfdie();
+		}
+	}
+
+	if (scf_value_get_astring(g_val, buf, sizeof (buf)) < 0) {
+		if (scf_error() != SCF_ERROR_TYPE_MISMATCH)
+			scfdie();
+		return (ST_UNKNOWN);
+	}
+
+	for (st = ST_UNKNOWN + 1; st < NSTATES; ++st) {
+		if (strcmp(buf, state_names[st]) == 0)
+			return (st);
+	}
+
+	return (ST_UNKNOWN);
+}
+
 static void
 usage(const char *argv0, int help, FILE *stream)
 {
 	(void) fprintf(stream,
-	    "Usage: %1$s [-s width,height] [-l legend.ps] [-x opts]\n"
-	    "       %1$s -L\n", argv0);
+	    "Usage: %1$s [-S] [-s width,height] [-l legend.ps] [-x opts] "
+	    "[-i index]\n"
+	    "       %1$s [-i index | -I index] [-q query | -q -]\n"
+	    "       %1$s [-i index] -d fmri[,fmri]... | -d -\n"
+	    "       %1$s [-s width,height] [-i index] -c index\n"
+	    "       %1$s [-s width,height] [-i index] -D view\n"
+	    "       %1$s [-i index] -H dir\n"
+	    "       %1$s [-S] [-i index] [-k keyint] -T log\n"
+	    "       %1$s -L\n"
+	    "-T log -t time may be given instead of -i index.  With either,\n"
+	    "-u refreshes the graph from the repository (and -I may also be\n"
+	    "given).  Otherwise -f filter limits what's read from the\n"
+	    "repository.\n", argv0);
 	if (help) {
 		const char * const *opt;
 
@@ -323,17 +516,46 @@ choose_color(const char *fmri, int enabled)
 	return (cp->colors[enabled ? 0 : 1]);
 }
 
+/*
+ * Adjust colors, as returned by choose_color(), for state st: maintenance and
+ * offline instances get MAINTFG or OFFLINEFG as their foreground.  Returns a
+ * pointer to a static array.
+ */
+static const char * const *
+state_color(const char * const *colors, uint32_t st)
+{
+	static const char *adjusted[2];
+
+	adjusted[0] = st == ST_MAINT ? MAINTFG : st == ST_OFFLINE ?
+	    OFFLINEFG : colors[0];
+	adjusted[1] = colors[1];
+
+	return (adjusted);
+}
+
 /*
  * Print a node for a service.  dependencies should either be an empty string
  * or a string of "<dependency port name> dependency name" strings joined by
- * pipes ("|").
+ * pipes ("|").  If colors is NULL, only the label is printed, and the shape
+ * and colors are left to the enclosing node defaults (see print_compact()).
  */
 static void
 print_service_node(const char *fmri, const char *label,
     const char *dependencies, const char * const *colors)
 {
-	const char *fg = colors[0];
-	const char *bg = colors[1];
+	const char *fg, *bg;
+
+	if (colors == NULL) {
+		if (dependencies[0] != '\0')
+			(void) printf("\"%s\" [label=\"{<foo> %s | {%s}}\"];\n",
+			    fmri, label, dependencies);
+		else
+			(void) printf("\"%s\" [label=\"%s\"];\n", fmri, label);
+		return;
+	}
+
+	fg = colors[0];
+	bg = colors[1];
 
 	if (dependencies[0] != '\0')
 		(void) printf("\"%s\" [shape=record,color=\"%s\",style=filled,"
@@ -401,6 +623,13 @@ print_legend()
 	    "svc:/other/enabled:default",
 	    "label=\"exclude_all\",arrowtail=odot", 1);
 
+	fmri = "svc:/system/maintenance:default";
+	print_service_node(fmri, fmri + 5, "",
+	    state_color(choose_color(fmri, 1), ST_MAINT));
+	fmri = "svc:/system/offline:default";
+	print_service_node(fmri, fmri + 5, "",
+	    state_color(choose_color(fmri, 1), ST_OFFLINE));
+
 	(void) printf("}\n}\n");
 }
 
@@ -435,294 +664,4347 @@ add_dep(const char *str)
 	strappend("|", &allpgs, &allpgs_sz);
 }
 
-static char *fmri, *dep_fmri;			/* max_fmri_len + 1 long */
-static char *instname, *pgname;			/* max_name_len + 1 long */
-static char *depname, *depname_copy, *grouping;	/* max_value_len + 1 long */
+static void *
+safe_realloc(void *ptr, size_t sz)
+{
+	if ((ptr = realloc(ptr, sz)) == NULL) {
+		perror("realloc");
+		exit(1);
+	}
+
+	return (ptr);
+}
 
 /*
- * For the given instance, generate a node and the appropriate edges.
+ * Make room for n more elements of size elsz in *arrp, which currently holds
+ * cnt elements and has room for *capp.
  */
-static int
-process_instance(scf_instance_t *i, const char *svcname)
+static void
+grow(void *arrp, uint32_t *capp, uint32_t cnt, uint32_t n, size_t elsz)
 {
-	int enabled;
-	int ndeps;
-	int inetd_svc;
-	int non_rpcbind;
+	void **ap = arrp;
+	uint32_t cap;
 
-	scf_snapshot_t *running;		/* NULL or == g_snap */
+	if (cnt + n <= *capp)
+		return;
 
-	assert(i);
+	for (cap = *capp != 0 ? *capp : 64; cap < cnt + n; cap *= 2)
+		;
 
-	/*
-	 * Node generation: Collect the name, restarter, dependency names, and
-	 * enabled status and call print_service_node().  The dependency names
-	 * will be accumulated in allpgs.
-	 */
+	*ap = safe_realloc(*ap, (size_t)cap * elsz);
+	*capp = cap;
+}
 
-	if (scf_instance_get_name(i, instname, max_name_len + 1) == -1) {
-		(void) fprintf(stderr, "instance_get_name() failed: %s",
-		    scf_strerror(scf_error()));
-		return (-1);
-	}
+/*
+ * The crawl records the dependency graph in memory rather than printing it
+ * directly, so that it can also be saved to and loaded from an index file
+ * (-I and -i) and queried (-q).
+ *
+ * Each instance visited by the crawl becomes a node with N_CRAWLED set;
+ * FMRIs which are only named by dependencies or restarter properties become
+ * nodes without it.  A crawled node owns a contiguous run of dependency groups
+ * (one per record port, the restarter included), and each dependency group a
+ * contiguous run of edges, all in crawl order, so print_graph() produces the
+ * same output as when the crawl printed as it went.  Strings are kept in a
+ * single table and referred to by offset, so the arrays can be written to an
+ * index file as they are.
+ */
 
-	(void) snprintf(fmri, max_fmri_len + 1, "svc:/%s:%s", svcname,
-	    instname);
+typedef enum grouping {
+	G_REQUIRE_ALL,
+	G_REQUIRE_ANY,
+	G_OPTIONAL_ALL,
+	G_EXCLUDE_ALL,
+	G_RESTARTER,
+	G_OTHER
+} grouping_t;
 
-	ndeps = 0;
-	allpgs[0] = '\0';
-	inetd_svc = 0;
+/*
+ * How edges are drawn for each grouping.  An edge between two enabled
+ * instances gets 2 more weight, unless it's a restarter edge.
+ */
+static const struct grouping_style {
+	const char	*name;
+	const char	*opts;
+	int		weight;
+} groupings[] = {
+	{ SCF_DEP_REQUIRE_ALL, "style=bold", 3 },
+	{ SCF_DEP_REQUIRE_ANY, "", 2 },
+	{ SCF_DEP_OPTIONAL_ALL, "style=dashed", 1 },
+	{ SCF_DEP_EXCLUDE_ALL, "arrowtail=odot", 1 },
+	{ "restarter", "", 1 },
+	{ "other", "", 1 }
+};
 
-	get_restarter(i, depname, max_value_len + 1);
+#define	NGROUPINGS	(sizeof (groupings) / sizeof (groupings[0]))
+#define	G_ALL		((1U << NGROUPINGS) - 1)
 
-	if (depname[0] != '\0') {
-		++ndeps;
-		add_dep("restarter");
-		inetd_svc = (strstr(depname, "network/inetd:default") != NULL);
-	}
+#define	NO_NODE		UINT32_MAX
 
-	if (scf_instance_get_snapshot(i, "running", g_snap) == 0) {
-		running = g_snap;
-	} else {
-		if (scf_error() != SCF_ERROR_NOT_FOUND)
-			scfdie();
-		running = NULL;
-	}
+struct node {
+	uint32_t	n_fmri;		/* string offset */
+	uint32_t	n_dg;		/* first dependency group */
+	uint32_t	n_ndgs;
+	uint32_t	n_flags;
+};
 
-	if (scf_iter_instance_pgs_typed_composed(g_pgiter, i, running,
-	    SCF_GROUP_DEPENDENCY) != 0)
-		scfdie();
+#define	N_CRAWLED	0x1
+#define	N_ENABLED	0x2
+#define	N_STATE_SHIFT	2	/* state_t, in bits 2-4 */
+#define	N_STATE_MASK	(0x7 << N_STATE_SHIFT)
+#define	N_EXCLUDED	0x20	/* excluded by the filter (-f) */
 
-	non_rpcbind = 0;
+#define	N_STATE(flags)	(((flags) & N_STATE_MASK) >> N_STATE_SHIFT)
 
-	while (scf_iter_next_pg(g_pgiter, g_pg) > 0) {
-		if (scf_pg_get_property(g_pg, SCF_PROPERTY_ENTITIES, NULL) !=
-		    0) {
-			if (scf_error() == SCF_ERROR_NOT_FOUND)
-				continue;
-			scfdie();
-		}
+struct depgroup {
+	uint32_t	dg_name;	/* string offset of cleaned pg name */
+	uint32_t	dg_node;	/* node which has the dependency */
+	uint32_t	dg_edge;	/* first edge */
+	uint32_t	dg_nedges;
+	uint32_t	dg_grouping;	/* grouping_t */
+};
 
-		++ndeps;
+struct edge {
+	uint32_t	e_dg;		/* dependency group (and source) */
+	uint32_t	e_to;		/* target node */
+	uint32_t	e_flags;
+};
 
-		if (scf_pg_get_name(g_pg, pgname, max_name_len + 1) < 0)
-			scfdie();
+#define	E_DST_ENABLED	0x1	/* both ends were enabled */
+#define	E_NETDEP	0x2	/* omitted under -x omit_net_deps */
+#define	E_SAMEENT	0x4	/* same dependency FMRI as previous edge */
 
-		if (!non_rpcbind && strcmp(pgname, "rpcbind") != 0)
-			non_rpcbind = 1;
+struct strslot {
+	uint32_t	s_off;		/* string offset, 0 if free */
+	uint32_t	s_node;		/* node with this FMRI, or NO_NODE */
+};
 
-		clean_name(pgname);
-		add_dep(pgname);
-	}
+struct graph {
+	char		*gr_str;	/* string table; offset 0 is "" */
+	uint32_t	gr_strsz, gr_strcap;
+	struct node	*gr_nodes;
+	uint32_t	gr_nnodes, gr_nodecap;
+	struct depgroup	*gr_dgs;
+	uint32_t	gr_ndgs, gr_dgcap;
+	struct edge	*gr_edges;
+	uint32_t	gr_nedges, gr_edgecap;
+	uint32_t	gr_label;	/* string offset of the graph label */
+
+	/* Built by graph_index(). */
+	uint32_t	*gr_byname;	/* node ids sorted by FMRI */
+	uint32_t	*gr_rank;	/* inverse of gr_byname */
+	uint32_t	*gr_revoff;	/* edges to n are in gr_rev[] from */
+	uint32_t	*gr_rev;	/* gr_revoff[n] to gr_revoff[n + 1] */
+
+	/* String hash, built on demand. */
+	struct strslot	*gr_hash;
+	uint32_t	gr_hashsz;	/* power of two */
+	uint32_t	gr_nstrs;
+};
 
-	if (consolidate_inetd_svcs && inetd_svc && ndeps == 1) {
-		strappend(fmri + sizeof ("svc:/") - 1, &inetd_svcs,
-		    &inetd_svcs_sz);
-		strappend("\\n", &inetd_svcs, &inetd_svcs_sz);
-		return (0);
-	}
+#define	GSTR(g, off)	((g)->gr_str + (off))
+#define	NODE_FMRI(g, n)	GSTR((g), (g)->gr_nodes[(n)].n_fmri)
 
-	if (consolidate_rpcbind_svcs && inetd_svc && non_rpcbind == 0 &&
-	    ndeps == 2) {
-		/*
-		 * Exclude network/rpc/meta and rpc/smserver since they have
-		 * dependents.
-		 */
-		if (strcmp(svcname, "network/rpc/meta") != 0 &&
-		    strcmp(svcname, "network/rpc/smserver") != 0) {
-			strappend(fmri + sizeof ("svc:/") - 1, &rpcbind_svcs,
-			    &rpcbind_svcs_sz);
-			strappend("\\n", &rpcbind_svcs, &rpcbind_svcs_sz);
-			return (0);
-		}
-	}
+static struct graph graph;
 
-	if (allpgs[0] != '\0')
-		allpgs[strlen(allpgs) - 1] = '\0';	/* nuke trailing | */
+static uint32_t
+strhash(const char *s)
+{
+	uint32_t h = 2166136261U;
 
-	enabled = is_enabled(i);
+	for (; *s != '\0'; ++s)
+		h = (h ^ (uint8_t)*s) * 16777619U;
 
-	print_service_node(fmri, fmri + sizeof ("svc:/") - 1, allpgs,
-	    choose_color(fmri, enabled));
+	return (h);
+}
 
-	/*
-	 * Edges: One for the restarter, if it is not the default (svc.startd)
-	 * (denoted by an empty string), and one for each dependency service.
-	 * Remember that dependency groups can name multiple services, and
-	 * each service can have multiple instances.
-	 */
+static void
+strhash_insert(struct graph *g, uint32_t off, uint32_t node)
+{
+	uint32_t i;
 
-	if (depname[0] != '\0')
-		print_dependency(fmri, "restarter", depname, "", 1);
+	for (i = strhash(GSTR(g, off)) & (g->gr_hashsz - 1);
+	    g->gr_hash[i].s_off != 0; i = (i + 1) & (g->gr_hashsz - 1))
+		;
 
-	if (scf_iter_instance_pgs_typed_composed(g_pgiter, i, running,
-	    SCF_GROUP_DEPENDENCY) != 0)
-		scfdie();
+	g->gr_hash[i].s_off = off;
+	g->gr_hash[i].s_node = node;
+	++g->gr_nstrs;
+}
 
-	for (;;) {
-		int r;
+/*
+ * (Re)build the string hash with room for at least n strings.  Graphs read
+ * from an index file don't have one until something is added to them.
+ */
+static void
+strhash_rebuild(struct graph *g, uint32_t n)
+{
+	uint32_t off, i, nstrs = 0;
 
-		r = scf_iter_next_pg(g_pgiter, g_pg);
-		if (r == 0)
-			break;
-		if (r < 0)
-			scfdie();
+	for (off = 1; off < g->gr_strsz; off += strlen(GSTR(g, off)) + 1)
+		++nstrs;
+	if (n < nstrs + 1)
+		n = nstrs + 1;
 
-		if (scf_pg_get_name(g_pg, pgname, max_name_len + 1) < 0)
-			scfdie();
-		clean_name(pgname);
+	for (g->gr_hashsz = 1024; g->gr_hashsz < 2 * n; g->gr_hashsz *= 2)
+		;
 
-		/* The grouping will dictate how we draw the edge */
-		if (scf_pg_get_property(g_pg, SCF_PROPERTY_GROUPING, g_prop) !=
-		    0)
-			scfdie();
+	free(g->gr_hash);
+	if ((g->gr_hash = calloc(g->gr_hashsz, sizeof (*g->gr_hash))) ==
+	    NULL) {
+		perror("calloc");
+		exit(1);
+	}
+	g->gr_nstrs = 0;
 
-		if (scf_property_get_value(g_prop, g_val) != 0)
-			scfdie();
+	for (off = 1; off < g->gr_strsz; off += strlen(GSTR(g, off)) + 1)
+		strhash_insert(g, off, NO_NODE);
 
-		if (scf_value_get_astring(g_val, grouping, max_value_len + 1) <
-		    0)
-			scfdie();
+	for (i = 0; i < g->gr_nnodes; ++i) {
+		struct strslot *sp;
+		uint32_t h;
 
-		/* ENTITIES holds the FMRIs of the dependencies */
-		if (scf_pg_get_property(g_pg, SCF_PROPERTY_ENTITIES, g_prop) !=
-		    0)
-			scfdie();
+		for (h = strhash(NODE_FMRI(g, i)) & (g->gr_hashsz - 1);
+		    ; h = (h + 1) & (g->gr_hashsz - 1)) {
+			sp = &g->gr_hash[h];
+			if (sp->s_off == g->gr_nodes[i].n_fmri)
+				break;
+		}
+		sp->s_node = i;
+	}
+}
 
-		if (scf_iter_property_values(g_valiter, g_prop) != 0)
-			scfdie();
+/*
+ * Return the hash slot for str, adding str to the string table if create is
+ * set.  Returns NULL if str isn't there and create isn't set.  The slot is
+ * only valid until the next string is added.
+ */
+static struct strslot *
+str_lookup(struct graph *g, const char *str, int create)
+{
+	struct strslot *sp;
+	uint32_t i, len;
 
-		for (;;) {
-			const char *sname, *iname;
-			int weight = 1;
-			char opts[100];
-			size_t l;
+	if (g->gr_hash == NULL || 2 * (g->gr_nstrs + 1) > g->gr_hashsz)
+		strhash_rebuild(g, g->gr_nstrs + 1);
 
-			r = scf_iter_next_value(g_valiter, g_val);
-			if (r == 0)
-				break;
-			if (r < 0)
-				scfdie();
+	for (i = strhash(str) & (g->gr_hashsz - 1); ;
+	    i = (i + 1) & (g->gr_hashsz - 1)) {
+		sp = &g->gr_hash[i];
+		if (sp->s_off == 0)
+			break;
+		if (strcmp(GSTR(g, sp->s_off), str) == 0)
+			return (sp);
+	}
 
-			if (scf_value_get_astring(g_val, depname,
-			    max_value_len + 1) < 0)
-				scfdie();
+	if (!create)
+		return (NULL);
 
-			(void) strcpy(depname_copy, depname);
+	if (g->gr_strsz == 0) {
+		grow(&g->gr_str, &g->gr_strcap, 0, 1, 1);
+		g->gr_str[0] = '\0';
+		g->gr_strsz = 1;
+	}
 
-			/*
-			 * This will fail if the dependency is on a file:,
-			 * which is legitimate, but we'll skip.
-			 *
-			 * This function leaves sname & iname pointing into
-			 * depname_copy, which may be modified.
-			 */
-			if (scf_parse_svc_fmri(depname_copy, NULL, &sname,
-			    &iname, NULL, NULL) != 0)
-				continue;
+	len = strlen(str) + 1;
+	grow(&g->gr_str, &g->gr_strcap, g->gr_strsz, len, 1);
+	(void) memcpy(g->gr_str + g->gr_strsz, str, len);
 
-			if (scf_handle_decode_fmri(h, depname, NULL, g_svc,
-			    g_inst, NULL, NULL, 0) != 0) {
-				if (scf_error() != SCF_ERROR_NOT_FOUND)
-					scfdie();
-				continue;
-			}
+	sp->s_off = g->gr_strsz;
+	sp->s_node = NO_NODE;
+	g->gr_strsz += len;
+	++g->gr_nstrs;
 
-			if (omit_net_deps &&
-			    (strcmp(sname, "network/loopback") == 0 ||
-			    strcmp(sname, "network/physical") == 0) &&
-			    !allowable_net_dep(fmri))
-				continue;
+	return (sp);
+}
 
-			opts[0] = '\0';
-			l = 0;
-			if (strcmp(grouping, SCF_DEP_OPTIONAL_ALL) == 0) {
-				l = strlcat(opts, "style=dashed,",
-				    sizeof (opts));
-			} else if (strcmp(grouping, SCF_DEP_EXCLUDE_ALL) == 0) {
-				l = strlcat(opts, "arrowtail=odot,",
-				    sizeof (opts));
-			} else if (strcmp(grouping, SCF_DEP_REQUIRE_ALL) == 0) {
-				weight += 2;
-				l = strlcat(opts, "style=bold,", sizeof (opts));
-			} else if (strcmp(grouping, SCF_DEP_REQUIRE_ANY) == 0) {
-				weight += 1;
-			}
+static uint32_t
+str_intern(struct graph *g, const char *str)
+{
+	if (str[0] == '\0')
+		return (0);
 
-			if (l >= sizeof (opts)) {
-				(void) fputs("opts[] is too small.\n", stderr);
-				exit(1);
-			}
+	return (str_lookup(g, str, 1)->s_off);
+}
 
-			if (opts[0] != '\0')
-				opts[strlen(opts) - 1] = '\0';
+/*
+ * Return the node for fmri, creating it if create is set.  Returns NO_NODE if
+ * there is no such node and create isn't set.
+ */
+static uint32_t
+node_lookup(struct graph *g, const char *fmri, int create)
+{
+	struct strslot *sp;
+	struct node *np;
 
-			if (iname == NULL) {
-				/*
-				 * This is a service dependency.  Look up the
-				 * service and output edges connecting that
-				 * service node to each of its instances.
-				 */
+	if ((sp = str_lookup(g, fmri, create)) == NULL)
+		return (NO_NODE);
 
-				if (scf_iter_service_instances(g_institer,
-				    g_svc) != 0)
-					scfdie();
+	if (sp->s_node != NO_NODE || !create)
+		return (sp->s_node);
 
-				for (;;) {
-					int i = 0;
+	grow(&g->gr_nodes, &g->gr_nodecap, g->gr_nnodes, 1, sizeof (*np));
+	np = &g->gr_nodes[g->gr_nnodes];
+	np->n_fmri = sp->s_off;
+	np->n_dg = g->gr_ndgs;
+	np->n_ndgs = 0;
+	np->n_flags = 0;
 
-					r = scf_iter_next_instance(g_institer,
-					    g_inst);
-					if (r == 0)
-						break;
-					if (r < 0)
-						scfdie();
+	return (sp->s_node = g->gr_nnodes++);
+}
 
-					if (scf_instance_to_fmri(g_inst,
-					    dep_fmri, max_fmri_len + 1) == -1)
-						scfdie();
+/*
+ * Add a dependency group to node n, which must be the node most recently
+ * given dependency groups.
+ */
+static uint32_t
+graph_add_dg(struct graph *g, uint32_t n, const char *name,
+    grouping_t grouping)
+{
+	struct depgroup *dgp;
+	uint32_t name_off;
+
+	name_off = str_intern(g, name);
+
+	grow(&g->gr_dgs, &g->gr_dgcap, g->gr_ndgs, 1, sizeof (*dgp));
+	dgp = &g->gr_dgs[g->gr_ndgs];
+	dgp->dg_name = name_off;
+	dgp->dg_node = n;
+	dgp->dg_edge = g->gr_nedges;
+	dgp->dg_nedges = 0;
+	dgp->dg_grouping = grouping;
+
+	if (g->gr_nodes[n].n_ndgs++ == 0)
+		g->gr_nodes[n].n_dg = g->gr_ndgs;
+
+	return (g->gr_ndgs++);
+}
+
+/*
+ * Add an edge to dependency group dg, which must be the most recently added
+ * dependency group.
+ */
+static void
+graph_add_edge(struct graph *g, uint32_t dg, uint32_t to, uint32_t flags)
+{
+	struct edge *ep;
+
+	grow(&g->gr_edges, &g->gr_edgecap, g->gr_nedges, 1, sizeof (*ep));
+	ep = &g->gr_edges[g->gr_nedges++];
+	ep->e_dg = dg;
+	ep->e_to = to;
+	ep->e_flags = flags;
+
+	++g->gr_dgs[dg].dg_nedges;
+}
+
+/*
+ * Set *firstp and *endp to the range of edges from node n.
+ */
+static void
+node_edges(const struct graph *g, uint32_t n, uint32_t *firstp,
+    uint32_t *endp)
+{
+	const struct node *np = &g->gr_nodes[n];
+	const struct depgroup *last;
+
+	if (np->n_ndgs == 0) {
+		*firstp = *endp = 0;
+		return;
+	}
+
+	last = &g->gr_dgs[np->n_dg + np->n_ndgs - 1];
+	*firstp = g->gr_dgs[np->n_dg].dg_edge;
+	*endp = last->dg_edge + last->dg_nedges;
+}
+
+static grouping_t
+parse_grouping(const char *str)
+{
+	int i;
+
+	for (i = 0; i < G_OTHER; ++i) {
+		if (strcmp(str, groupings[i].name) == 0)
+			return (i);
+	}
+
+	return (G_OTHER);
+}
+
+static const struct graph *sort_graph;
+
+static int
+byname_cmp(const void *a, const void *b)
+{
+	return (strcmp(NODE_FMRI(sort_graph, *(const uint32_t *)a),
+	    NODE_FMRI(sort_graph, *(const uint32_t *)b)));
+}
+
+/*
+ * Build the lookup structures: the nodes sorted by FMRI and the reverse
+ * adjacency lists.  The forward adjacency lists are the edge runs themselves.
+ */
+static void
+graph_index(struct graph *g)
+{
+	uint32_t i;
+
+	free(g->gr_byname);
+	free(g->gr_rank);
+	free(g->gr_revoff);
+	free(g->gr_rev);
+
+	g->gr_byname = safe_realloc(NULL, (g->gr_nnodes + 1) *
+	    sizeof (uint32_t));
+	g->gr_rank = safe_realloc(NULL, (g->gr_nnodes + 1) *
+	    sizeof (uint32_t));
+	g->gr_revoff = safe_realloc(NULL, (g->gr_nnodes + 1) *
+	    sizeof (uint32_t));
+	g->gr_rev = safe_realloc(NULL, (g->gr_nedges + 1) *
+	    sizeof (uint32_t));
+
+	for (i = 0; i < g->gr_nnodes; ++i)
+		g->gr_byname[i] = i;
+
+	sort_graph = g;
+	qsort(g->gr_byname, g->gr_nnodes, sizeof (uint32_t), byname_cmp);
+
+	for (i = 0; i < g->gr_nnodes; ++i)
+		g->gr_rank[g->gr_byname[i]] = i;
+
+	/* Counting sort of the edges by target. */
+	(void) memset(g->gr_revoff, 0, (g->gr_nnodes + 1) * sizeof (uint32_t));
+	for (i = 0; i < g->gr_nedges; ++i)
+		++g->gr_revoff[g->gr_edges[i].e_to + 1];
+	for (i = 0; i < g->gr_nnodes; ++i)
+		g->gr_revoff[i + 1] += g->gr_revoff[i];
+	for (i = 0; i < g->gr_nedges; ++i)
+		g->gr_rev[g->gr_revoff[g->gr_edges[i].e_to]++] = i;
+	for (i = g->gr_nnodes; i > 0; --i)
+		g->gr_revoff[i] = g->gr_revoff[i - 1];
+	g->gr_revoff[0] = 0;
+}
+
+/*
+ * Return the node for fmri in an indexed graph, or NO_NODE.
+ */
+static uint32_t
+graph_find(const struct graph *g, const char *fmri)
+{
+	uint32_t lo = 0, hi = g->gr_nnodes;
+
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		int c = strcmp(fmri, NODE_FMRI(g, g->gr_byname[mid]));
+
+		if (c == 0)
+			return (g->gr_byname[mid]);
+		if (c < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return (NO_NODE);
+}
+
+/*
+ * Crawl filters (-f).  A filter is an expression of
+ *
+ *	prefix=str	the instance's FMRI begins with str ("svc:/" may be
+ *			omitted)
+ *	enabled		the instance is enabled
+ *	restarter=fmri	the instance's restarter is fmri (svc.startd's, if it
+ *			names none; "svc:/" may be omitted)
+ *	grouping=g	the dependency group has grouping g
+ *
+ * joined with ! (not), & (and), and | (or), in decreasing order of
+ * precedence, and parentheses.  Instances for which the filter is false,
+ * whatever their dependency groups, are excluded from the graph, along with
+ * edges to them, and dependency groups for which it's false are omitted.
+ *
+ * To avoid reading what would only be thrown away, the filter is evaluated
+ * as early as possible, with what's known at the time: for each service,
+ * with only the service name; then for each instance, with its name; then
+ * after reading whether it's enabled and its restarter; and then for each
+ * dependency group, with its grouping, before its entities are read.  What
+ * isn't known yet evaluates to F_UNKNOWN, and anything but F_FALSE means
+ * "keep going."
+ */
+
+#define	F_FALSE		0
+#define	F_TRUE		1
+#define	F_UNKNOWN	2
+
+typedef enum {
+	FO_AND,
+	FO_OR,
+	FO_NOT,
+	FO_PREFIX,
+	FO_ENABLED,
+	FO_RESTARTER,
+	FO_GROUPING
+} filter_op_t;
+
+static struct fnode {
+	filter_op_t	f_op;
+	uint32_t	f_left;		/* operands of FO_AND, FO_OR, FO_NOT */
+	uint32_t	f_right;
+	char		*f_str;		/* FO_PREFIX, FO_RESTARTER */
+	grouping_t	f_grouping;	/* FO_GROUPING */
+} *filter;
+static uint32_t filter_nnodes, filter_cap, filter_root = NO_NODE;
+
+#define	STARTD_FMRI	"svc:/system/svc/restarter:default"
+
+/* What's known when evaluating the filter. */
+struct fctx {
+	const char	*fc_fmri;	/* or a prefix of it, if !fc_complete */
+	int		fc_complete;
+	int		fc_enabled;	/* -1 if unknown */
+	const char	*fc_restarter;	/* NULL if unknown */
+	int		fc_grouping;	/* -1 if unknown */
+};
+
+static const char *filter_pos;
+
+static uint32_t filter_parse_or(void);
+
+static uint32_t
+filter_add(filter_op_t op, uint32_t left, uint32_t right)
+{
+	struct fnode *fp;
+
+	grow(&filter, &filter_cap, filter_nnodes, 1, sizeof (*fp));
+	fp = &filter[filter_nnodes];
+	fp->f_op = op;
+	fp->f_left = left;
+	fp->f_right = right;
+	fp->f_str = NULL;
+
+	return (filter_nnodes++);
+}
+
+static void
+filter_skip_space(void)
+{
+	while (*filter_pos == ' ' || *filter_pos == '\t')
+		++filter_pos;
+}
+
+static void
+filter_error(const char *msg)
+{
+	(void) fprintf(stderr, "bad filter: %s at \"%s\"\n", msg, filter_pos);
+	exit(2);
+}
+
+/*
+ * Parse the value of an atom, up to the next operator, parenthesis, or space.
+ */
+static char *
+filter_value(void)
+{
+	size_t len = strcspn(filter_pos, "&|!() \t");
+	char *val;
+
+	if (len == 0)
+		filter_error("missing value");
+
+	val = safe_realloc(NULL, len + 1);
+	(void) memcpy(val, filter_pos, len);
+	val[len] = '\0';
+	filter_pos += len;
+
+	return (val);
+}
+
+/*
+ * Parse a value which names services, adding "svc:/" if it was omitted.
+ */
+static char *
+filter_fmri_value(void)
+{
+	char *val = filter_value(), *fmri;
+
+	if (strncmp(val, "svc:", sizeof ("svc:") - 1) == 0)
+		return (val);
+
+	fmri = safe_realloc(NULL, strlen(val) + sizeof ("svc:/"));
+	(void) strcpy(fmri, "svc:/");
+	(void) strcat(fmri, val);
+	free(val);
+
+	return (fmri);
+}
+
+static uint32_t
+filter_parse_factor(void)
+{
+	uint32_t f;
+	char *val;
+
+	filter_skip_space();
+
+	if (*filter_pos == '!') {
+		++filter_pos;
+		return (filter_add(FO_NOT, filter_parse_factor(), NO_NODE));
+	}
+
+	if (*filter_pos == '(') {
+		++filter_pos;
+		f = filter_parse_or();
+		filter_skip_space();
+		if (*filter_pos != ')')
+			filter_error("expected )");
+		++filter_pos;
+		return (f);
+	}
+
+	if (strncmp(filter_pos, "enabled", sizeof ("enabled") - 1) == 0 &&
+	    strchr("&|!() \t", filter_pos[sizeof ("enabled") - 1]) != NULL) {
+		filter_pos += sizeof ("enabled") - 1;
+		return (filter_add(FO_ENABLED, NO_NODE, NO_NODE));
+	}
+
+	if (strncmp(filter_pos, "prefix=", sizeof ("prefix=") - 1) == 0) {
+		filter_pos += sizeof ("prefix=") - 1;
+		f = filter_add(FO_PREFIX, NO_NODE, NO_NODE);
+		filter[f].f_str = filter_fmri_value();
+		return (f);
+	}
+
+	if (strncmp(filter_pos, "restarter=", sizeof ("restarter=") - 1) ==
+	    0) {
+		filter_pos += sizeof ("restarter=") - 1;
+		f = filter_add(FO_RESTARTER, NO_NODE, NO_NODE);
+		filter[f].f_str = filter_fmri_value();
+		return (f);
+	}
+
+	if (strncmp(filter_pos, "grouping=", sizeof ("grouping=") - 1) == 0) {
+		filter_pos += sizeof ("grouping=") - 1;
+		f = filter_add(FO_GROUPING, NO_NODE, NO_NODE);
+		val = filter_value();
+		filter[f].f_grouping = parse_grouping(val);
+		if (filter[f].f_grouping == G_OTHER)
+			filter_error("unknown grouping");
+		free(val);
+		return (f);
+	}
+
+	filter_error("expected prefix=, enabled, restarter=, grouping=, !, "
+	    "or (");
+	/* NOTREACHED */
+	return (NO_NODE);
+}
+
+static uint32_t
+filter_parse_and(void)
+{
+	uint32_t f = filter_parse_factor();
+
+	for (;;) {
+		filter_skip_space();
+		if (*filter_pos != '&')
+			return (f);
+		++filter_pos;
+		f = filter_add(FO_AND, f, filter_parse_factor());
+	}
+}
+
+static uint32_t
+filter_parse_or(void)
+{
+	uint32_t f = filter_parse_and();
+
+	for (;;) {
+		filter_skip_space();
+		if (*filter_pos != '|')
+			return (f);
+		++filter_pos;
+		f = filter_add(FO_OR, f, filter_parse_and());
+	}
+}
+
+static void
+filter_parse(const char *expr)
+{
+	filter_pos = expr;
+	filter_root = filter_parse_or();
+	filter_skip_space();
+	if (*filter_pos != '\0')
+		filter_error("unexpected text");
+}
+
+static int
+filter_eval_node(uint32_t f, const struct fctx *fc)
+{
+	const struct fnode *fp = &filter[f];
+	size_t len, known;
+	int l, r;
+
+	switch (fp->f_op) {
+	case FO_AND:
+		l = filter_eval_node(fp->f_left, fc);
+		if (l == F_FALSE)
+			return (F_FALSE);
+		r = filter_eval_node(fp->f_right, fc);
+		return (r == F_FALSE ? F_FALSE : l == F_TRUE && r == F_TRUE ?
+		    F_TRUE : F_UNKNOWN);
+
+	case FO_OR:
+		l = filter_eval_node(fp->f_left, fc);
+		if (l == F_TRUE)
+			return (F_TRUE);
+		r = filter_eval_node(fp->f_right, fc);
+		return (r == F_TRUE ? F_TRUE : l == F_FALSE && r == F_FALSE ?
+		    F_FALSE : F_UNKNOWN);
+
+	case FO_NOT:
+		l = filter_eval_node(fp->f_left, fc);
+		return (l == F_UNKNOWN ? F_UNKNOWN : !l);
+
+	case FO_PREFIX:
+		/*
+		 * If we only know the start of the FMRI, we can only tell if
+		 * it's long enough to cover the prefix or already differs.
+		 */
+		len = strlen(fp->f_str);
+		known = strlen(fc->fc_fmri);
+		if (strncmp(fc->fc_fmri, fp->f_str,
+		    len < known ? len : known) != 0)
+			return (F_FALSE);
+		return (len <= known ? F_TRUE : fc->fc_complete ? F_FALSE :
+		    F_UNKNOWN);
+
+	case FO_ENABLED:
+		return (fc->fc_enabled == -1 ? F_UNKNOWN : fc->fc_enabled != 0);
+
+	case FO_RESTARTER:
+		if (fc->fc_restarter == NULL)
+			return (F_UNKNOWN);
+		return (strcmp(fp->f_str, fc->fc_restarter[0] != '\0' ?
+		    fc->fc_restarter : STARTD_FMRI) == 0);
+
+	case FO_GROUPING:
+		return (fc->fc_grouping == -1 ? F_UNKNOWN :
+		    fc->fc_grouping == (int)fp->f_grouping);
+
+	default:
+		abort();
+		/* NOTREACHED */
+		return (F_UNKNOWN);
+	}
+}
+
+/*
+ * Evaluate the filter, if there is one, for fmri (or an FMRI which begins
+ * with it, if !complete) with the given enabled setting (-1 if unknown),
+ * restarter (NULL if unknown), and grouping (-1 if unknown).
+ */
+static int
+filter_eval(const char *fmri, int complete, int enabled,
+    const char *restarter, int grouping)
+{
+	struct fctx fc;
+
+	if (filter_root == NO_NODE)
+		return (F_TRUE);
+
+	fc.fc_fmri = fmri;
+	fc.fc_complete = complete;
+	fc.fc_enabled = enabled;
+	fc.fc_restarter = restarter;
+	fc.fc_grouping = grouping;
+
+	return (filter_eval_node(filter_root, &fc));
+}
+
+/*
+ * What the crawl read, and what the filter let it skip, for -S.  (See
+ * report_filter().)
+ */
+static struct crawl_stats {
+	uint32_t	cs_svcs;	/* services crawled */
+	uint32_t	cs_svcs_skipped; /* ... and those which weren't */
+	uint32_t	cs_insts;	/* instances read */
+	uint32_t	cs_insts_on;	/* ... which were enabled */
+	uint32_t	cs_insts_skipped; /* ... skipped by name */
+	uint32_t	cs_insts_enabled; /* ... after is_enabled() */
+	uint32_t	cs_insts_restarter; /* ... and get_restarter() */
+	uint32_t	cs_pgs;		/* dependency groups read */
+	uint32_t	cs_pgs_skipped;	/* ... skipped after their grouping */
+	uint32_t	cs_values;	/* entities read */
+	uint32_t	cs_edges_dropped; /* edges to excluded instances */
+} cstats;
+
+/*
+ * Remove the nodes the filter excluded, and the edges to them, from g, so
+ * nothing done with the graph afterward (printing, queries, saving it) sees
+ * them.  They have no dependency groups of their own.  A dependency group
+ * left without edges goes too, and with it its record port.  An edge which
+ * starts an entity (a service dependency's run of instances) passes that on
+ * to the next edge kept, so sim_init() doesn't join the rest of the run to
+ * the previous entity.  The excluded FMRIs stay in the string table, but the
+ * string hash has to be rebuilt for the new node ids.
+ */
+static void
+graph_drop_excluded(struct graph *g)
+{
+	uint32_t *map;
+	uint32_t n, d, e, nn = 0, nd = 0, ne = 0;
+
+	map = safe_realloc(NULL, (g->gr_nnodes + 1) * sizeof (uint32_t));
+
+	for (n = 0; n < g->gr_nnodes; ++n) {
+		if (g->gr_nodes[n].n_flags & N_EXCLUDED) {
+			assert(g->gr_nodes[n].n_ndgs == 0);
+			map[n] = NO_NODE;
+			continue;
+		}
+		map[n] = nn;
+		g->gr_nodes[nn] = g->gr_nodes[n];
+		g->gr_nodes[nn].n_dg = 0;
+		g->gr_nodes[nn++].n_ndgs = 0;
+	}
+
+	/* Groups keep their order, so each node's stay contiguous. */
+	for (d = 0; d < g->gr_ndgs; ++d) {
+		struct depgroup dg = g->gr_dgs[d];
+		struct node *np;
+		uint32_t first = ne;
+		int newent = 0;
+
+		for (e = dg.dg_edge; e < dg.dg_edge + dg.dg_nedges; ++e) {
+			struct edge *ep = &g->gr_edges[e];
+
+			if (map[ep->e_to] == NO_NODE) {
+				if (!(ep->e_flags & E_SAMEENT))
+					newent = 1;
+				++cstats.cs_edges_dropped;
+				continue;
+			}
+			ep->e_dg = nd;
+			ep->e_to = map[ep->e_to];
+			if (newent)
+				ep->e_flags &= ~E_SAMEENT;
+			newent = 0;
+			g->gr_edges[ne++] = *ep;
+		}
+
+		if (dg.dg_nedges != 0 && ne == first)
+			continue;
+
+		dg.dg_node = map[dg.dg_node];
+		dg.dg_edge = first;
+		dg.dg_nedges = ne - first;
+
+		np = &g->gr_nodes[dg.dg_node];
+		if (np->n_ndgs++ == 0)
+			np->n_dg = nd;
+		g->gr_dgs[nd++] = dg;
+	}
+
+	g->gr_nnodes = nn;
+	g->gr_ndgs = nd;
+	g->gr_nedges = ne;
+	free(map);
+
+	free(g->gr_hash);
+	g->gr_hash = NULL;
+}
+
+static char *fmri, *dep_fmri;			/* max_fmri_len + 1 long */
+static char *instname, *pgname;			/* max_name_len + 1 long */
+static char *depname, *depname_copy, *grouping;	/* max_value_len + 1 long */
+static char *restarter;				/* max_value_len + 1 long */
+
+/*
+ * For the given instance, add a node and the appropriate edges to g.
+ */
+static int
+process_instance(struct graph *g, scf_instance_t *i, const char *svcname)
+{
+	int enabled, r;
+	uint32_t n, dg;
+	grouping_t gr;
+
+	scf_snapshot_t *running;		/* NULL or == g_snap */
+
+	assert(i);
+
+	if (scf_instance_get_name(i, instname, max_name_len + 1) == -1) {
+		(void) fprintf(stderr, "instance_get_name() failed: %s",
+		    scf_strerror(scf_error()));
+		return (-1);
+	}
+
+	(void) snprintf(fmri, max_fmri_len + 1, "svc:/%s:%s", svcname,
+	    instname);
+
+	n = node_lookup(g, fmri, 1);
+	if (g->gr_nodes[n].n_flags & (N_CRAWLED | N_EXCLUDED))
+		return (0);
+
+	if (filter_eval(fmri, 1, -1, NULL, -1) == F_FALSE) {
+		g->gr_nodes[n].n_flags |= N_EXCLUDED;
+		++cstats.cs_insts_skipped;
+		return (0);
+	}
+
+	enabled = is_enabled(i);
+
+	/* Don't read the restarter if the filter can do without it. */
+	r = filter_eval(fmri, 1, enabled, NULL, -1);
+	if (r == F_FALSE) {
+		g->gr_nodes[n].n_flags |= N_EXCLUDED;
+		++cstats.cs_insts_enabled;
+		return (0);
+	}
+
+	get_restarter(i, restarter, max_value_len + 1);
+
+	if (r == F_UNKNOWN &&
+	    filter_eval(fmri, 1, enabled, restarter, -1) == F_FALSE) {
+		g->gr_nodes[n].n_flags |= N_EXCLUDED;
+		++cstats.cs_insts_restarter;
+		return (0);
+	}
+
+	++cstats.cs_insts;
+	if (enabled)
+		++cstats.cs_insts_on;
+	g->gr_nodes[n].n_flags |= N_CRAWLED | (enabled ? N_ENABLED : 0) |
+	    get_state(i) << N_STATE_SHIFT;
+
+	/*
+	 * Edges: One for the restarter, if it is not the default (svc.startd)
+	 * (denoted by an empty string), and one for each dependency service.
+	 * Remember that dependency groups can name multiple services, and
+	 * each service can have multiple instances.
+	 */
+
+	if (restarter[0] != '\0' &&
+	    filter_eval(fmri, 1, enabled, restarter, G_RESTARTER) != F_FALSE) {
+		dg = graph_add_dg(g, n, "restarter", G_RESTARTER);
+		graph_add_edge(g, dg, node_lookup(g, restarter, 1), 0);
+	}
+
+	if (scf_instance_get_snapshot(i, "running", g_snap) == 0) {
+		running = g_snap;
+	} else {
+		if (scf_error() != SCF_ERROR_NOT_FOUND)
+			scfdie();
+		running = NULL;
+	}
+
+	if (scf_iter_instance_pgs_typed_composed(g_pgiter, i, running,
+	    SCF_GROUP_DEPENDENCY) != 0)
+		scfdie();
+
+	for (;;) {
+		r = scf_iter_next_pg(g_pgiter, g_pg);
+		if (r == 0)
+			break;
+		if (r < 0)
+			scfdie();
+
+		/* ENTITIES holds the FMRIs of the dependencies */
+		if (scf_pg_get_property(g_pg, SCF_PROPERTY_ENTITIES, NULL) !=
+		    0) {
+			if (scf_error() == SCF_ERROR_NOT_FOUND)
+				continue;
+			scfdie();
+		}
+
+		if (scf_pg_get_name(g_pg, pgname, max_name_len + 1) < 0)
+			scfdie();
+		clean_name(pgname);
+
+		/* The grouping will dictate how we draw the edge */
+		if (scf_pg_get_property(g_pg, SCF_PROPERTY_GROUPING, g_prop) !=
+		    0)
+			scfdie();
+
+		if (scf_property_get_value(g_prop, g_val) != 0)
+			scfdie();
+
+		if (scf_value_get_astring(g_val, grouping, max_value_len + 1) <
+		    0)
+			scfdie();
+
+		gr = parse_grouping(grouping);
+		if (filter_eval(fmri, 1, enabled, restarter, gr) == F_FALSE) {
+			++cstats.cs_pgs_skipped;
+			continue;
+		}
+
+		++cstats.cs_pgs;
+		dg = graph_add_dg(g, n, pgname, gr);
+
+		if (scf_pg_get_property(g_pg, SCF_PROPERTY_ENTITIES, g_prop) !=
+		    0)
+			scfdie();
+
+		if (scf_iter_property_values(g_valiter, g_prop) != 0)
+			scfdie();
+
+		for (;;) {
+			const char *sname, *iname;
+			uint32_t flags = 0;
+
+			r = scf_iter_next_value(g_valiter, g_val);
+			if (r == 0)
+				break;
+			if (r < 0)
+				scfdie();
+
+			if (scf_value_get_astring(g_val, depname,
+			    max_value_len + 1) < 0)
+				scfdie();
+
+			++cstats.cs_values;
+			(void) strcpy(depname_copy, depname);
+
+			/*
+			 * This will fail if the dependency is on a file:,
+			 * which is legitimate, but we'll skip.
+			 *
+			 * This function leaves sname & iname pointing into
+			 * depname_copy, which may be modified.
+			 */
+			if (scf_parse_svc_fmri(depname_copy, NULL, &sname,
+			    &iname, NULL, NULL) != 0)
+				continue;
+
+			if (scf_handle_decode_fmri(h, depname, NULL, g_svc,
+			    g_inst, NULL, NULL, 0) != 0) {
+				if (scf_error() != SCF_ERROR_NOT_FOUND)
+					scfdie();
+				continue;
+			}
+
+			if ((strcmp(sname, "network/loopback") == 0 ||
+			    strcmp(sname, "network/physical") == 0) &&
+			    !allowable_net_dep(fmri))
+				flags |= E_NETDEP;
+
+			if (iname == NULL) {
+				/*
+				 * This is a service dependency.  Look up the
+				 * service and add edges connecting that
+				 * service node to each of its instances.
+				 */
+
+				if (scf_iter_service_instances(g_institer,
+				    g_svc) != 0)
+					scfdie();
+
+				for (;;) {
+					uint32_t f = flags;
+
+					r = scf_iter_next_instance(g_institer,
+					    g_inst);
+					if (r == 0)
+						break;
+					if (r < 0)
+						scfdie();
+
+					if (scf_instance_to_fmri(g_inst,
+					    dep_fmri, max_fmri_len + 1) == -1)
+						scfdie();
 
 					if (enabled && is_enabled(g_inst))
-						i = 2;
+						f |= E_DST_ENABLED;
+
+					graph_add_edge(g, dg,
+					    node_lookup(g, dep_fmri, 1), f);
+					flags |= E_SAMEENT;
+				}
+			} else {
+				if (enabled && is_enabled(g_inst))
+					flags |= E_DST_ENABLED;
+
+				graph_add_edge(g, dg,
+				    node_lookup(g, depname, 1), flags);
+			}
+		}
+	}
+
+	return (0);
+}
+
+/*
+ * Set g's label to the system's name and the current time.
+ */
+static void
+set_label(struct graph *g)
+{
+	struct utsname utn;
+	int r;
+	time_t now;
+	char timebuf[30];
+	char *label;
+	size_t label_sz;
+
+	r = uname(&utn);
+	assert(r >= 0);
+
+	now = time(NULL);
+	(void) cftime(timebuf, NULL, &now);
+
+	label_sz = strlen(utn.sysname) + strlen(utn.version) +
+	    strlen(utn.machine) + strlen(timebuf) + 5;
+	label = safe_realloc(NULL, label_sz);
+	(void) snprintf(label, label_sz, "%s %s %s\\n%s", utn.sysname,
+	    utn.version, utn.machine, timebuf);
+	g->gr_label = str_intern(g, label);
+	free(label);
+}
+
+/*
+ * Connect to the repository and create the objects and buffers shared by
+ * crawl() and refresh().
+ */
+static void
+scf_init(void)
+{
+	h = scf_handle_create(SCF_VERSION);
+	if (scf_handle_bind(h) != 0)
+		scfdie();
+
+	if ((g_svc = scf_service_create(h)) == NULL ||
+	    (g_inst = scf_instance_create(h)) == NULL ||
+	    (g_snap = scf_snapshot_create(h)) == NULL ||
+	    (g_institer = scf_iter_create(h)) == NULL ||
+	    (g_pgiter = scf_iter_create(h)) == NULL ||
+	    (g_valiter = scf_iter_create(h)) == NULL ||
+	    (g_pg = scf_pg_create(h)) == NULL ||
+	    (g_prop = scf_property_create(h)) == NULL ||
+	    (g_val = scf_value_create(h)) == NULL)
+		scfdie();
+
+	if ((max_name_len = scf_limit(SCF_LIMIT_MAX_NAME_LENGTH)) < 0 ||
+	    (max_value_len = scf_limit(SCF_LIMIT_MAX_VALUE_LENGTH)) < 0 ||
+	    (max_fmri_len = scf_limit(SCF_LIMIT_MAX_FMRI_LENGTH)) < 0)
+		scfdie();
+
+	if ((instname = malloc(max_name_len + 1)) == NULL ||
+	    (pgname = malloc(max_name_len + 1)) == NULL ||
+	    (depname = malloc(max_value_len + 1)) == NULL ||
+	    (depname_copy = malloc(max_value_len + 1)) == NULL ||
+	    (grouping = malloc(max_value_len + 1)) == NULL ||
+	    (restarter = malloc(max_value_len + 1)) == NULL ||
+	    (fmri = malloc(max_fmri_len + 1)) == NULL ||
+	    (dep_fmri = malloc(max_fmri_len + 1)) == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+}
+
+/*
+ * Call process_instance() for each service instance in the repository.
+ */
+static void
+crawl(struct graph *g)
+{
+	int r;
+	scf_scope_t *scope;
+	scf_service_t *svc;
+	scf_instance_t *inst;
+	scf_iter_t *svciter, *institer;
+	char *svcname;
+
+	set_label(g);
+	scf_init();
+
+	if ((scope = scf_scope_create(h)) == NULL ||
+	    (svc = scf_service_create(h)) == NULL ||
+	    (inst = scf_instance_create(h)) == NULL ||
+	    (svciter = scf_iter_create(h)) == NULL ||
+	    (institer = scf_iter_create(h)) == NULL)
+		scfdie();
+
+	if ((svcname = malloc(max_name_len + 1)) == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+
+	if (scf_handle_get_scope(h, SCF_SCOPE_LOCAL, scope) != 0)
+		scfdie();
+
+	if (scf_iter_scope_services(svciter, scope) != 0)
+		scfdie();
+
+	for (;;) {
+		r = scf_iter_next_service(svciter, svc);
+		if (r == 0)
+			break;
+		if (r != 1)
+			scfdie();
+
+		if (scf_service_get_name(svc, svcname, max_name_len + 1) < 0)
+			scfdie();
+
+		if (strcmp(svcname, "system/svc/restarter") == 0)
+			/* Otherwise this shows up as an unconnected node. */
+			continue;
+
+		/* Skip the service if the filter excludes all its instances. */
+		(void) snprintf(fmri, max_fmri_len + 1, "svc:/%s:", svcname);
+		if (filter_eval(fmri, 0, -1, NULL, -1) == F_FALSE) {
+			++cstats.cs_svcs_skipped;
+			continue;
+		}
+		++cstats.cs_svcs;
+
+		if (scf_iter_service_instances(institer, svc) != 0)
+			scfdie();
+
+		for (;;) {
+			r = scf_iter_next_instance(institer, inst);
+			if (r == 0)
+				break;
+			if (r != 1)
+				scfdie();
+
+			if (process_instance(g, inst, svcname) != 0) {
+				(void) fputs("process_instance() failed",
+				    stderr);
+				exit(1);
+			}
+		}
+	}
+
+	/*
+	 * Exclude the instances which were only named by dependencies, too, if
+	 * we can tell.
+	 */
+	if (filter_root != NO_NODE) {
+		uint32_t n;
+
+		for (n = 0; n < g->gr_nnodes; ++n) {
+			if (!(g->gr_nodes[n].n_flags &
+			    (N_CRAWLED | N_EXCLUDED)) &&
+			    filter_eval(NODE_FMRI(g, n), 1, -1, NULL, -1) ==
+			    F_FALSE)
+				g->gr_nodes[n].n_flags |= N_EXCLUDED;
+		}
+
+		graph_drop_excluded(g);
+	}
+
+	graph_index(g);
+}
+
+/*
+ * Report what the filter let the crawl skip.  The repository calls which
+ * weren't made can't be counted, so their number is an estimate, from the
+ * number of calls each step of the crawl makes, below, and the averages of
+ * what was read: instances per service, dependency groups per instance, and
+ * entities per group.  The CALLS_ constants count the libscf calls which go
+ * to the repository (not scf_value_get_*(), which don't) in the named code,
+ * and must be kept in step with it.
+ */
+#define	CALLS_SVC	2	/* crawl(): instance iteration and its end */
+#define	CALLS_INST	2	/* crawl(): next instance; get its name */
+#define	CALLS_ENABLED	3	/* is_enabled() */
+#define	CALLS_RESTARTER	3	/* get_restarter() */
+#define	CALLS_STATE	3	/* get_state() */
+#define	CALLS_DEPS	3	/* process_instance(): snapshot, pg iteration */
+					/* and its end */
+#define	CALLS_PG	5	/* ... a dependency group, up to its grouping */
+#define	CALLS_PG_ENTS	3	/* ... its entities' iteration and its end */
+#define	CALLS_ENTITY	2	/* ... an entity: next value; decode */
+					/* (plus is_enabled() if enabled) */
+
+static void
+report_filter(void)
+{
+	double pgs, ents, insts, on, deps, inst;
+	uint32_t read = cstats.cs_insts + cstats.cs_insts_skipped +
+	    cstats.cs_insts_enabled + cstats.cs_insts_restarter;
+
+	pgs = cstats.cs_insts == 0 ? 0.0 :
+	    (double)(cstats.cs_pgs + cstats.cs_pgs_skipped) / cstats.cs_insts;
+	ents = cstats.cs_pgs == 0 ? 0.0 :
+	    (double)cstats.cs_values / cstats.cs_pgs;
+	insts = cstats.cs_svcs == 0 ? 0.0 : (double)read / cstats.cs_svcs;
+	on = cstats.cs_insts == 0 ? 0.0 :
+	    (double)cstats.cs_insts_on / cstats.cs_insts;
+
+	/* Calls for an instance's dependencies, and for all of it. */
+	deps = CALLS_DEPS + pgs * (CALLS_PG + CALLS_PG_ENTS +
+	    ents * (CALLS_ENTITY + on * CALLS_ENABLED));
+	inst = CALLS_ENABLED + CALLS_RESTARTER + CALLS_STATE + deps;
+
+	(void) fprintf(stderr, "%u of %u services skipped\n",
+	    cstats.cs_svcs_skipped, cstats.cs_svcs + cstats.cs_svcs_skipped);
+	(void) fprintf(stderr, "%u of %u instances skipped (%u after reading "
+	    "whether they're enabled, and %u more after reading their "
+	    "restarters)\n", read - cstats.cs_insts, read,
+	    cstats.cs_insts_enabled, cstats.cs_insts_restarter);
+	(void) fprintf(stderr, "%u of %u dependency groups skipped\n",
+	    cstats.cs_pgs_skipped, cstats.cs_pgs + cstats.cs_pgs_skipped);
+	(void) fprintf(stderr, "%u edges to excluded instances removed\n",
+	    cstats.cs_edges_dropped);
+	(void) fprintf(stderr, "about %.0f repository calls avoided "
+	    "(estimated)\n",
+	    cstats.cs_svcs_skipped * (CALLS_SVC + insts * (CALLS_INST + inst)) +
+	    cstats.cs_insts_skipped * inst +
+	    cstats.cs_insts_enabled * (inst - CALLS_ENABLED) +
+	    cstats.cs_insts_restarter * (deps + CALLS_STATE) +
+	    cstats.cs_pgs_skipped * (CALLS_PG_ENTS +
+	    ents * (CALLS_ENTITY + on * CALLS_ENABLED)));
+}
+
+/*
+ * Refresh g, read from an index or log, from the repository (-u): re-read
+ * only what changes at run time -- whether each instance is enabled, and its
+ * state -- and recompute the edge flags which depend on it, keeping the
+ * dependencies.  That's a lookup and two property reads per instance, rather
+ * than everything in its dependency property groups.  Instances which have
+ * been deleted are shown as disabled; those which have been added, and any
+ * changes to dependencies, need a new crawl.
+ */
+static void
+refresh(struct graph *g)
+{
+	uint8_t *enabled;
+	uint32_t n, e, missing = 0;
+
+	set_label(g);
+	scf_init();
+
+	enabled = safe_realloc(NULL, g->gr_nnodes + 1);
+
+	for (n = 0; n < g->gr_nnodes; ++n) {
+		struct node *np = &g->gr_nodes[n];
+		uint32_t st = ST_UNKNOWN;
+
+		enabled[n] = 0;
+
+		if (scf_handle_decode_fmri(h, NODE_FMRI(g, n), NULL, NULL,
+		    g_inst, NULL, NULL, 0) == 0) {
+			enabled[n] = is_enabled(g_inst);
+			st = get_state(g_inst);
+		} else {
+			switch (scf_error()) {
+			case SCF_ERROR_NOT_FOUND:
+				if (np->n_flags & N_CRAWLED)
+					++missing;
+				break;
+
+			case SCF_ERROR_INVALID_ARGUMENT:
+			case SCF_ERROR_CONSTRAINT_VIOLATED:
+				/* Not an instance. */
+				break;
+
+			default:
+				scfdie();
+			}
+		}
+
+		/* Only crawled nodes record their own state. */
+		if (np->n_flags & N_CRAWLED)
+			np->n_flags = (np->n_flags &
+			    ~(N_ENABLED | N_STATE_MASK)) |
+			    (enabled[n] ? N_ENABLED : 0) | st << N_STATE_SHIFT;
+	}
+
+	/* As in process_instance(): restarter edges are never weighted. */
+	for (e = 0; e < g->gr_nedges; ++e) {
+		struct edge *ep = &g->gr_edges[e];
+		const struct depgroup *dgp = &g->gr_dgs[ep->e_dg];
+
+		ep->e_flags &= ~E_DST_ENABLED;
+		if (dgp->dg_grouping != G_RESTARTER &&
+		    enabled[dgp->dg_node] && enabled[ep->e_to])
+			ep->e_flags |= E_DST_ENABLED;
+	}
+
+	free(enabled);
+
+	if (missing != 0)
+		(void) fprintf(stderr, "%u instances no longer exist; crawl "
+		    "the repository again to remove them\n", missing);
+}
+
+/*
+ * Statistics about the graph printed, reported on the standard error under
+ * -S.
+ */
+static struct stats {
+	uint32_t	st_nodes;	/* instance nodes printed */
+	uint32_t	st_consolidated; /* instances consolidated */
+	uint32_t	st_edges;	/* edges from those nodes */
+	uint32_t	st_omitted;	/* ... omitted by omit_net_deps */
+	uint32_t	st_dups;	/* ... removed as duplicates */
+	uint32_t	st_merged;	/* ... merged into parallel edges */
+	uint32_t	st_printed;	/* edges printed */
+	uint32_t	st_ranked;	/* nodes put on ranks by rank_levels */
+	uint32_t	st_ranks;	/* ... and the number of ranks */
+	uint32_t	st_unranked;	/* ... and those left to dot */
+} stats;
+
+static int print_stats = 0;
+
+/*
+ * Edges to print for the current node, so duplicate and parallel ones can be
+ * found.  pe_dg[to] is the last dependency group with an edge to node to, and
+ * pe_node[to] the last node, in which case pe_slot[to] is that edge's index in
+ * pe[].  Merged edges are chained through pe_next from the first one.
+ */
+static struct pending_edge {
+	uint32_t	pe_to;
+	uint32_t	pe_dg;
+	int		pe_weight;
+	uint32_t	pe_next;	/* next edge merged into this one */
+	uint32_t	pe_last;	/* last edge merged into this one */
+	int		pe_merged;	/* merged into an earlier edge */
+} *pe;
+static uint32_t pe_cap;
+static uint32_t *pe_dg, *pe_node, *pe_slot;
+static char *mergebuf;
+static size_t mergebuf_sz;
+
+static void
+pending_init(const struct graph *g)
+{
+	uint32_t i;
+
+	pe_dg = safe_realloc(NULL, (g->gr_nnodes + 1) * sizeof (uint32_t));
+	pe_node = safe_realloc(NULL, (g->gr_nnodes + 1) * sizeof (uint32_t));
+	pe_slot = safe_realloc(NULL, (g->gr_nnodes + 1) * sizeof (uint32_t));
+
+	for (i = 0; i < g->gr_nnodes; ++i)
+		pe_dg[i] = pe_node[i] = NO_NODE;
+
+	mergebuf_sz = 100;
+	mergebuf = safe_realloc(NULL, mergebuf_sz);
+}
+
+/*
+ * Edges held back under -x compact until all of the nodes have been printed,
+ * so they can be printed by class.  de_label is the offset of the label of a
+ * merged edge in delabels, or NO_NODE.
+ */
+static struct deferred_edge {
+	uint32_t	de_dg;		/* dependency group it leaves through */
+	uint32_t	de_to;
+	uint32_t	de_label;
+	int		de_weight;
+} *de;
+static uint32_t nde, de_cap;
+static char *delabels;
+static uint32_t delabels_sz, delabels_cap;
+
+static void
+defer_edge(uint32_t dg, uint32_t to, const char *label, int weight)
+{
+	struct deferred_edge *dp;
+
+	grow(&de, &de_cap, nde, 1, sizeof (*de));
+	dp = &de[nde++];
+	dp->de_dg = dg;
+	dp->de_to = to;
+	dp->de_weight = weight;
+	dp->de_label = NO_NODE;
+
+	if (label != NULL) {
+		uint32_t len = strlen(label) + 1;
+
+		grow(&delabels, &delabels_cap, delabels_sz, len, 1);
+		(void) memcpy(delabels + delabels_sz, label, len);
+		dp->de_label = delabels_sz;
+		delabels_sz += len;
+	}
+}
+
+/*
+ * Print the edges for node n's dependencies, removing duplicates (edges
+ * between the same nodes through the same port) under -x dedup_edges and
+ * merging parallel edges (between the same nodes through different ports)
+ * under -x merge_edges.  A merged edge leaves through the port of its
+ * strongest dependency, is labeled with the names of all of them, and gets the
+ * highest weight among them.
+ */
+static void
+print_node_edges(const struct graph *g, uint32_t n)
+{
+	const struct node *np = &g->gr_nodes[n];
+	const char *nfmri = NODE_FMRI(g, n);
+	uint32_t npe = 0, d, e, i, j;
+
+	for (d = np->n_dg; d < np->n_dg + np->n_ndgs; ++d) {
+		const struct depgroup *dgp = &g->gr_dgs[d];
+
+		for (e = dgp->dg_edge; e < dgp->dg_edge + dgp->dg_nedges;
+		    ++e) {
+			const struct edge *ep = &g->gr_edges[e];
+			uint32_t to = ep->e_to;
+			struct pending_edge *pp;
+
+			++stats.st_edges;
+
+			if (omit_net_deps && (ep->e_flags & E_NETDEP)) {
+				++stats.st_omitted;
+				continue;
+			}
+
+			if (dedup_edges || merge_edges) {
+				if (pe_dg[to] == d) {
+					++stats.st_dups;
+					continue;
+				}
+				pe_dg[to] = d;
+			}
+
+			grow(&pe, &pe_cap, npe, 1, sizeof (*pe));
+			pp = &pe[npe];
+			pp->pe_to = to;
+			pp->pe_dg = d;
+			pp->pe_weight = groupings[dgp->dg_grouping].weight +
+			    (ep->e_flags & E_DST_ENABLED ? 2 : 0);
+			pp->pe_next = pp->pe_last = NO_NODE;
+			pp->pe_merged = 0;
+
+			if (merge_edges && pe_node[to] == n) {
+				struct pending_edge *hp = &pe[pe_slot[to]];
+
+				if (hp->pe_last == NO_NODE)
+					hp->pe_next = npe;
+				else
+					pe[hp->pe_last].pe_next = npe;
+				hp->pe_last = npe;
+				pp->pe_merged = 1;
+				++stats.st_merged;
+			} else {
+				pe_node[to] = n;
+				pe_slot[to] = npe;
+			}
+
+			++npe;
+		}
+	}
+
+	for (i = 0; i < npe; ++i) {
+		const struct pending_edge *pp = &pe[i];
+		const struct pending_edge *best = pp;
+		const struct depgroup *bdg;
+
+		if (pp->pe_merged)
+			continue;
+
+		++stats.st_printed;
+
+		if (pp->pe_next == NO_NODE) {
+			const struct depgroup *dgp = &g->gr_dgs[pp->pe_dg];
+
+			if (compact)
+				defer_edge(pp->pe_dg, pp->pe_to, NULL,
+				    pp->pe_weight);
+			else
+				print_dependency(nfmri, GSTR(g, dgp->dg_name),
+				    NODE_FMRI(g, pp->pe_to),
+				    groupings[dgp->dg_grouping].opts,
+				    pp->pe_weight);
+			continue;
+		}
+
+		(void) strcpy(mergebuf, "label=\"");
+		for (j = i; j != NO_NODE; j = pe[j].pe_next) {
+			const struct pending_edge *mp = &pe[j];
+
+			if (j != i)
+				strappend(",", &mergebuf, &mergebuf_sz);
+			strappend(GSTR(g, g->gr_dgs[mp->pe_dg].dg_name),
+			    &mergebuf, &mergebuf_sz);
+
+			if (mp->pe_weight > best->pe_weight ||
+			    (mp->pe_weight == best->pe_weight &&
+			    g->gr_dgs[mp->pe_dg].dg_grouping <
+			    g->gr_dgs[best->pe_dg].dg_grouping))
+				best = mp;
+		}
+		strappend("\"", &mergebuf, &mergebuf_sz);
+
+		if (compact) {
+			defer_edge(best->pe_dg, pp->pe_to, mergebuf,
+			    best->pe_weight);
+			continue;
+		}
+
+		bdg = &g->gr_dgs[best->pe_dg];
+		if (groupings[bdg->dg_grouping].opts[0] != '\0') {
+			strappend(",", &mergebuf, &mergebuf_sz);
+			strappend(groupings[bdg->dg_grouping].opts, &mergebuf,
+			    &mergebuf_sz);
+		}
+
+		print_dependency(nfmri, GSTR(g, bdg->dg_name),
+		    NODE_FMRI(g, pp->pe_to), mergebuf, best->pe_weight);
+	}
+}
+
+static void
+report_stats(void)
+{
+	uint32_t removed = stats.st_dups + stats.st_merged;
+	uint32_t kept = stats.st_edges - stats.st_omitted;
+
+	(void) fprintf(stderr, "%u instance nodes printed, %u consolidated\n",
+	    stats.st_nodes, stats.st_consolidated);
+	(void) fprintf(stderr, "%u edges, %u omitted, %u duplicates removed, "
+	    "%u merged into parallel edges\n", stats.st_edges,
+	    stats.st_omitted, stats.st_dups, stats.st_merged);
+	(void) fprintf(stderr, "%u edges printed (%u fewer, %.1f%%)\n",
+	    stats.st_printed, removed, kept == 0 ? 0.0 :
+	    100.0 * removed / kept);
+	if (rank_levels)
+		(void) fprintf(stderr, "%u nodes on %u ranks, %u in or "
+		    "below cycles left to dot\n", stats.st_ranked,
+		    stats.st_ranks, stats.st_unranked);
+}
+
+/*
+ * Print the graph settings common to all of our dot files.
+ */
+static void
+print_graph_settings(const char *size)
+{
+	(void) printf("node [shape=box,fontname=\"Helvetica\",fontsize=11];\n");
+	if (size != NULL)
+		(void) printf("size=\"%s\";\n", size);
+	(void) printf("ranksep=\"2\";\n"
+	    "rankdir=LR;\n"
+	    "margin=1;\n");
+}
+
+#define	CONS_NONE	0
+#define	CONS_INETD	1	/* part of inetd_services */
+#define	CONS_RPCBIND	2	/* part of rpcbind_services */
+
+/*
+ * Decide whether crawled node n should be consolidated into inetd_services
+ * (if it only depends on its restarter, inetd) or rpcbind_services (if it
+ * also depends on rpcbind).
+ */
+static int
+consolidation(const struct graph *g, uint32_t n)
+{
+	const struct node *np = &g->gr_nodes[n];
+	const char *nfmri = NODE_FMRI(g, n);
+	int inetd_svc = 0, non_rpcbind = 0;
+	uint32_t d;
+
+	for (d = np->n_dg; d < np->n_dg + np->n_ndgs; ++d) {
+		const struct depgroup *dgp = &g->gr_dgs[d];
+
+		if (dgp->dg_grouping == G_RESTARTER) {
+			inetd_svc = (dgp->dg_nedges != 0 && strstr(NODE_FMRI(g,
+			    g->gr_edges[dgp->dg_edge].e_to),
+			    "network/inetd:default") != NULL);
+		} else if (strcmp(GSTR(g, dgp->dg_name), "rpcbind") != 0) {
+			non_rpcbind = 1;
+		}
+	}
+
+	if (consolidate_inetd_svcs && inetd_svc && np->n_ndgs == 1)
+		return (CONS_INETD);
+
+	/*
+	 * Exclude network/rpc/meta and rpc/smserver since they have
+	 * dependents.
+	 */
+	if (consolidate_rpcbind_svcs && inetd_svc && non_rpcbind == 0 &&
+	    np->n_ndgs == 2 &&
+	    strncmp(nfmri, "svc:/network/rpc/meta:",
+	    sizeof ("svc:/network/rpc/meta:") - 1) != 0 &&
+	    strncmp(nfmri, "svc:/network/rpc/smserver:",
+	    sizeof ("svc:/network/rpc/smserver:") - 1) != 0)
+		return (CONS_RPCBIND);
+
+	return (CONS_NONE);
+}
+
+/*
+ * Rank constraints (-x rank_levels).  dot spends much of its time finding an
+ * order for the nodes which the require_* dependencies already give us, so
+ * compute it here: each node's level is the length of the longest chain of
+ * require_* edges from a node nothing requires to it.  Nodes on a level are
+ * put in a rank=same subgraph, in order of the barycenter of their dependents'
+ * positions on earlier levels.  The subgraphs are printed before any of the
+ * nodes are, so that's the order in which the nodes are declared, and dot's
+ * initial ordering, which visits the nodes in that order, starts from it
+ * rather than from the FMRI order.  (Under -x compact the nodes have to be
+ * declared by class first, so only the ranks are kept.)
+ *
+ * Under -x pin_milestones, milestones also get ranks of their own and are put
+ * in a group, so the chain of milestones is drawn straight.  Nodes in cycles
+ * (and their dependencies) get no level and are left to dot, as are nodes
+ * without require_* edges.
+ */
+
+#define	RK_PRINTED	0x1	/* printed, so its edges count */
+#define	RK_MEMBER	0x2	/* has a require_* edge */
+
+static uint8_t *rk_flags;
+static uint32_t *rk_indeg;
+static uint32_t *rk_key;	/* level * 2 + is a pinned milestone */
+static uint32_t *rk_pos;	/* position in its rank */
+static double *rk_bary;
+
+static int
+rank_edge(const struct graph *g, const struct edge *ep)
+{
+	grouping_t gr = g->gr_dgs[ep->e_dg].dg_grouping;
+
+	return ((gr == G_REQUIRE_ALL || gr == G_REQUIRE_ANY) &&
+	    !(omit_net_deps && (ep->e_flags & E_NETDEP)));
+}
+
+static int
+is_milestone(const struct graph *g, uint32_t n)
+{
+	return (strncmp(NODE_FMRI(g, n), "svc:/milestone/",
+	    sizeof ("svc:/milestone/") - 1) == 0);
+}
+
+static int
+bary_cmp(const void *a, const void *b)
+{
+	uint32_t na = *(const uint32_t *)a, nb = *(const uint32_t *)b;
+	uint32_t ra = sort_graph->gr_rank[na], rb = sort_graph->gr_rank[nb];
+
+	if (rk_bary[na] != rk_bary[nb])
+		return (rk_bary[na] < rk_bary[nb] ? -1 : 1);
+	return (ra < rb ? -1 : ra > rb);
+}
+
+static void
+print_ranks(const struct graph *g)
+{
+	uint32_t nn = g->gr_nnodes;
+	uint32_t *queue, *bucket, *start;
+	uint32_t head = 0, tail = 0, nkeys = 0, i, n, d, e, k;
+
+	rk_flags = safe_realloc(NULL, nn + 1);
+	rk_indeg = safe_realloc(NULL, (nn + 1) * sizeof (uint32_t));
+	rk_key = safe_realloc(NULL, (nn + 1) * sizeof (uint32_t));
+	rk_pos = safe_realloc(NULL, (nn + 1) * sizeof (uint32_t));
+	rk_bary = safe_realloc(NULL, (nn + 1) * sizeof (double));
+	queue = safe_realloc(NULL, (nn + 1) * sizeof (uint32_t));
+
+	for (n = 0; n < nn; ++n) {
+		rk_flags[n] = 0;
+		rk_indeg[n] = 0;
+		rk_key[n] = NO_NODE;
+	}
+
+	for (n = 0; n < nn; ++n) {
+		const struct node *np = &g->gr_nodes[n];
+
+		if (!(np->n_flags & N_CRAWLED) ||
+		    consolidation(g, n) != CONS_NONE)
+			continue;
+		rk_flags[n] |= RK_PRINTED;
+
+		for (d = np->n_dg; d < np->n_dg + np->n_ndgs; ++d) {
+			const struct depgroup *dgp = &g->gr_dgs[d];
+
+			for (e = dgp->dg_edge;
+			    e < dgp->dg_edge + dgp->dg_nedges; ++e) {
+				const struct edge *ep = &g->gr_edges[e];
+
+				if (!rank_edge(g, ep))
+					continue;
+				rk_flags[n] |= RK_MEMBER;
+				rk_flags[ep->e_to] |= RK_MEMBER;
+				++rk_indeg[ep->e_to];
+			}
+		}
+	}
+
+	/* Kahn's algorithm, keeping the longest distance to each node. */
+	for (i = 0; i < nn; ++i) {
+		n = g->gr_byname[i];
+		if ((rk_flags[n] & RK_MEMBER) && rk_indeg[n] == 0) {
+			rk_key[n] = 0;
+			queue[tail++] = n;
+		}
+	}
+
+	while (head < tail) {
+		const struct node *np;
+
+		n = queue[head++];
+		if (!(rk_flags[n] & RK_PRINTED))
+			continue;
+
+		np = &g->gr_nodes[n];
+		for (d = np->n_dg; d < np->n_dg + np->n_ndgs; ++d) {
+			const struct depgroup *dgp = &g->gr_dgs[d];
+
+			for (e = dgp->dg_edge;
+			    e < dgp->dg_edge + dgp->dg_nedges; ++e) {
+				const struct edge *ep = &g->gr_edges[e];
+				uint32_t to = ep->e_to;
+
+				if (!rank_edge(g, ep))
+					continue;
+				if (rk_key[to] == NO_NODE ||
+				    rk_key[to] < rk_key[n] + 1)
+					rk_key[to] = rk_key[n] + 1;
+				if (--rk_indeg[to] == 0)
+					queue[tail++] = to;
+			}
+		}
+	}
+
+	/*
+	 * Turn levels into keys, and bucket the ranked nodes by key (in FMRI
+	 * order, which breaks barycenter ties).
+	 */
+	for (n = 0; n < nn; ++n) {
+		if (rk_key[n] == NO_NODE)
+			continue;
+		if (rk_indeg[n] != 0) {
+			/* Reached only from a cycle. */
+			rk_key[n] = NO_NODE;
+			continue;
+		}
+		rk_key[n] = rk_key[n] * 2 +
+		    (pin_milestones && is_milestone(g, n));
+		if (rk_key[n] + 1 > nkeys)
+			nkeys = rk_key[n] + 1;
+	}
+
+	start = safe_realloc(NULL, (nkeys + 1) * sizeof (uint32_t));
+	bucket = queue;
+	for (k = 0; k <= nkeys; ++k)
+		start[k] = 0;
+	for (n = 0; n < nn; ++n) {
+		if (rk_key[n] != NO_NODE)
+			++start[rk_key[n] + 1];
+	}
+	for (k = 0; k < nkeys; ++k)
+		start[k + 1] += start[k];
+	for (n = 0; n < nn; ++n) {
+		if (rk_key[n] != NO_NODE)
+			bucket[start[rk_key[n]]++] = n;
+	}
+	for (k = nkeys; k > 0; --k)
+		start[k] = start[k - 1];
+	start[0] = 0;
+
+	sort_graph = g;
+	(void) printf("\n/* ranks */\n");
+
+	for (k = 0; k < nkeys; ++k) {
+		uint32_t *b = &bucket[start[k]];
+		uint32_t cnt = start[k + 1] - start[k];
+
+		if (cnt == 0)
+			continue;
+
+		for (i = 0; i < cnt; ++i) {
+			double sum = 0;
+			uint32_t npreds = 0;
+
+			n = b[i];
+			for (e = g->gr_revoff[n]; e < g->gr_revoff[n + 1];
+			    ++e) {
+				const struct edge *ep =
+				    &g->gr_edges[g->gr_rev[e]];
+				uint32_t from = g->gr_dgs[ep->e_dg].dg_node;
+
+				if (!rank_edge(g, ep) ||
+				    !(rk_flags[from] & RK_PRINTED) ||
+				    rk_key[from] == NO_NODE ||
+				    rk_key[from] >= k)
+					continue;
+				sum += rk_pos[from];
+				++npreds;
+			}
+			rk_bary[n] = npreds == 0 ? 0 : sum / npreds;
+		}
+
+		qsort(b, cnt, sizeof (uint32_t), bary_cmp);
+
+		(void) printf("{\nrank=same;\n");
+		for (i = 0; i < cnt; ++i) {
+			rk_pos[b[i]] = i;
+			(void) printf("\"%s\"%s;\n", NODE_FMRI(g, b[i]),
+			    k % 2 == 1 ? " [group=milestones]" : "");
+		}
+		(void) printf("}\n");
+
+		stats.st_ranked += cnt;
+		++stats.st_ranks;
+	}
+
+	for (n = 0; n < nn; ++n) {
+		if ((rk_flags[n] & RK_MEMBER) && rk_key[n] == NO_NODE)
+			++stats.st_unranked;
+	}
+
+	free(start);
+	free(queue);
+	free(rk_bary);
+	free(rk_pos);
+	free(rk_key);
+	free(rk_indeg);
+	free(rk_flags);
+}
+
+/*
+ * Collect the names of node n's dependency groups in allpgs, for
+ * print_service_node().
+ */
+static void
+node_pgs(const struct graph *g, uint32_t n)
+{
+	const struct node *np = &g->gr_nodes[n];
+	uint32_t d;
+
+	allpgs[0] = '\0';
+
+	for (d = np->n_dg; d < np->n_dg + np->n_ndgs; ++d)
+		add_dep(GSTR(g, g->gr_dgs[d].dg_name));
+
+	if (allpgs[0] != '\0')
+		allpgs[strlen(allpgs) - 1] = '\0';	/* nuke | */
+}
+
+/*
+ * Node classes under -x compact: the distinct pairs of foreground and fill
+ * colors of the nodes printed, in order of first appearance.  There are at
+ * most three (for the states) for each coloring and enabledness.
+ */
+#define	MAX_CLASSES	(3 * 2 * sizeof (category_colors) / \
+	sizeof (category_colors[0]))
+#define	NO_CLASS	UINT8_MAX
+
+static const char *class_colors[MAX_CLASSES][2];
+static uint8_t nclasses;
+
+static uint8_t
+node_class(const struct node *np, const char *fmri)
+{
+	const char * const *colors = state_color(choose_color(fmri,
+	    np->n_flags & N_ENABLED), N_STATE(np->n_flags));
+	uint8_t c;
+
+	for (c = 0; c < nclasses; ++c) {
+		if (strcmp(class_colors[c][0], colors[0]) == 0 &&
+		    strcmp(class_colors[c][1], colors[1]) == 0)
+			return (c);
+	}
+
+	assert(nclasses < MAX_CLASSES);
+	class_colors[nclasses][0] = colors[0];
+	class_colors[nclasses][1] = colors[1];
+	return (nclasses++);
+}
+
+/*
+ * Print the nodes of g, by class, and the edges held back by print_node_edges()
+ * under -x compact.  Each class of nodes goes in an anonymous subgraph whose
+ * node defaults give the shape and colors, so the nodes themselves carry only
+ * their labels.  Likewise, the edges are grouped by grouping and weight, with
+ * the style and weight as edge defaults.  All of the nodes are printed before
+ * any of the edges, which would otherwise create nodes they named early with
+ * the wrong defaults.
+ */
+static void
+print_compact(const struct graph *g, const uint8_t *nclass)
+{
+	uint32_t c, n, i;
+
+	for (c = 0; c < nclasses; ++c) {
+		(void) printf("subgraph {\nnode [shape=record,color=\"%s\","
+		    "style=filled,fillcolor=\"%s\",fontcolor=\"%s\"];\n",
+		    class_colors[c][0], class_colors[c][1],
+		    class_colors[c][0]);
+
+		for (n = 0; n < g->gr_nnodes; ++n) {
+			const char *nfmri = NODE_FMRI(g, n);
+
+			if (nclass[n] != c)
+				continue;
+
+			node_pgs(g, n);
+			print_service_node(nfmri, nfmri + sizeof ("svc:/") - 1,
+			    allpgs, NULL);
+		}
+
+		(void) printf("}\n");
+	}
+
+	if (rank_levels)
+		print_ranks(g);
+
+	/* Edge weights are the grouping's, plus 2 if the target is enabled. */
+	for (c = 0; c < NGROUPINGS * 2; ++c) {
+		uint32_t gr = c / 2;
+		const char *opts = groupings[gr].opts;
+		int weight = groupings[gr].weight + (c % 2) * 2;
+		int started = 0;
+
+		for (i = 0; i < nde; ++i) {
+			const struct deferred_edge *dp = &de[i];
+			const struct depgroup *dgp = &g->gr_dgs[dp->de_dg];
+
+			if (dgp->dg_grouping != gr || dp->de_weight != weight)
+				continue;
+
+			if (!started) {
+				(void) printf("subgraph {\n"
+				    "edge [%s%sweight=%d];\n", opts,
+				    opts[0] != '\0' ? "," : "", weight);
+				started = 1;
+			}
+
+			/* A weight of 1 isn't printed, leaving the default. */
+			print_dependency(NODE_FMRI(g, dgp->dg_node),
+			    GSTR(g, dgp->dg_name), NODE_FMRI(g, dp->de_to),
+			    dp->de_label != NO_NODE ? delabels + dp->de_label :
+			    NULL, 1);
+		}
+
+		if (started)
+			(void) printf("}\n");
+	}
+
+	free(de);
+	free(delabels);
+	de = NULL;
+	delabels = NULL;
+	nde = de_cap = delabels_sz = delabels_cap = 0;
+}
+
+/*
+ * Print the dot file for g: graph settings, then a node and its edges for each
+ * crawled instance, consolidating some of them if requested.  Under -x
+ * compact, the nodes and edges are printed afterward by print_compact().
+ */
+static void
+print_graph(const struct graph *g, const char *size, const char *legendfile)
+{
+	uint32_t n;
+	uint8_t *nclass = NULL;
+
+	pending_init(g);
+
+	if (compact) {
+		nclass = safe_realloc(NULL, g->gr_nnodes + 1);
+		(void) memset(nclass, NO_CLASS, g->gr_nnodes + 1);
+	}
+
+	(void) printf("digraph scf {\n");
+	(void) printf("label=\"%s\";\n", GSTR(g, g->gr_label));
+	print_graph_settings(size);
+
+	if (legendfile != NULL)
+		/*
+		 * The legend is just a node with the given PostScript as its
+		 * shape.  dot will put it on the highest rank.  It usually
+		 * appears too close to another node (system/zones, in
+		 * particular); avoid that with a sufficiently large margin.
+		 * (See expand.awk .)
+		 */
+		(void) printf("\n/* legend */\n"
+		    "legend [shape=epsf,shapefile=\"%s\",label=\"\"];\n",
+		    legendfile);
+
+	if (rank_levels && !compact)
+		print_ranks(g);
+
+	(void) putchar('\n');
+
+	for (n = 0; n < g->gr_nnodes; ++n) {
+		const struct node *np = &g->gr_nodes[n];
+		const char *nfmri = NODE_FMRI(g, n);
+
+		if (!(np->n_flags & N_CRAWLED))
+			continue;
+
+		switch (consolidation(g, n)) {
+		case CONS_INETD:
+			strappend(nfmri + sizeof ("svc:/") - 1, &inetd_svcs,
+			    &inetd_svcs_sz);
+			strappend("\\n", &inetd_svcs, &inetd_svcs_sz);
+			++stats.st_consolidated;
+			continue;
+
+		case CONS_RPCBIND:
+			strappend(nfmri + sizeof ("svc:/") - 1, &rpcbind_svcs,
+			    &rpcbind_svcs_sz);
+			strappend("\\n", &rpcbind_svcs, &rpcbind_svcs_sz);
+			++stats.st_consolidated;
+			continue;
+		}
+
+		++stats.st_nodes;
+
+		if (compact) {
+			nclass[n] = node_class(np, nfmri);
+			print_node_edges(g, n);
+			continue;
+		}
+
+		/*
+		 * Node generation: Collect the dependency names and call
+		 * print_service_node().
+		 */
+		node_pgs(g, n);
+		print_service_node(nfmri, nfmri + sizeof ("svc:/") - 1,
+		    allpgs, state_color(choose_color(nfmri,
+		    np->n_flags & N_ENABLED), N_STATE(np->n_flags)));
+
+		print_node_edges(g, n);
+	}
+
+	if (compact) {
+		print_compact(g, nclass);
+		free(nclass);
+	}
+
+	if (inetd_svcs[0] != '\0') {
+		print_service_node("inetd_services", inetd_svcs,
+		    "<restarter> restarter", choose_color("network/", 1));
+		print_dependency("inetd_services", "restarter",
+		    "svc:/network/inetd:default", "", 1);
+	}
+
+	if (rpcbind_svcs[0] != '\0') {
+		print_service_node("rpcbind_services", rpcbind_svcs,
+		    "<restarter> restarter | <rpcbind> rpcbind",
+		    choose_color("network/", 1));
+		print_dependency("rpcbind_services", "restarter",
+		    "svc:/network/inetd:default", "", 1);
+		print_dependency("rpcbind_services", "rpcbind",
+		    "svc:/network/rpc/bind:default", "", 1);
+	}
+
+	(void) printf("}\n");
+}
+
+/*
+ * Return whether off is the offset of a string in g's string table.
+ */
+static int
+index_str_ok(const struct graph *g, uint32_t off)
+{
+	return (off == 0 || (off < g->gr_strsz && g->gr_str[off - 1] == '\0'));
+}
+
+/*
+ * Check that everything graph_load() read refers to something which exists,
+ * so a damaged index can't send us past the ends of the arrays, and fill in
+ * gr_rank.  Returns -1 if it doesn't.
+ */
+static int
+index_check(struct graph *g)
+{
+	uint32_t i, e;
+
+	if (g->gr_strsz != 0 && g->gr_str[g->gr_strsz - 1] != '\0')
+		return (-1);
+	g->gr_str[g->gr_strsz] = '\0';
+	if (!index_str_ok(g, g->gr_label))
+		return (-1);
+
+	for (i = 0; i < g->gr_nnodes; ++i) {
+		const struct node *np = &g->gr_nodes[i];
+
+		if (!index_str_ok(g, np->n_fmri) ||
+		    N_STATE(np->n_flags) >= NSTATES || (np->n_ndgs != 0 &&
+		    (np->n_dg >= g->gr_ndgs ||
+		    np->n_ndgs > g->gr_ndgs - np->n_dg)))
+			return (-1);
+		g->gr_rank[i] = NO_NODE;
+	}
+
+	for (i = 0; i < g->gr_ndgs; ++i) {
+		const struct depgroup *dgp = &g->gr_dgs[i];
+		const struct node *np;
+
+		if (!index_str_ok(g, dgp->dg_name) ||
+		    dgp->dg_node >= g->gr_nnodes ||
+		    dgp->dg_grouping >= NGROUPINGS ||
+		    (dgp->dg_grouping == G_RESTARTER && dgp->dg_nedges == 0) ||
+		    dgp->dg_edge > g->gr_nedges ||
+		    dgp->dg_nedges > g->gr_nedges - dgp->dg_edge)
+			return (-1);
+
+		np = &g->gr_nodes[dgp->dg_node];
+		if (i < np->n_dg || i - np->n_dg >= np->n_ndgs)
+			return (-1);
+
+		for (e = dgp->dg_edge; e < dgp->dg_edge + dgp->dg_nedges; ++e) {
+			if (g->gr_edges[e].e_dg != i ||
+			    g->gr_edges[e].e_to >= g->gr_nnodes)
+				return (-1);
+		}
+	}
+
+	for (e = 0; e < g->gr_nedges; ++e) {
+		if (g->gr_edges[e].e_dg >= g->gr_ndgs || g->gr_rev[e] >=
+		    g->gr_nedges)
+			return (-1);
+	}
+
+	if (g->gr_revoff[0] != 0 || g->gr_revoff[g->gr_nnodes] != g->gr_nedges)
+		return (-1);
+
+	for (i = 0; i < g->gr_nnodes; ++i) {
+		uint32_t n = g->gr_byname[i];
+
+		if (n >= g->gr_nnodes || g->gr_rank[n] != NO_NODE ||
+		    g->gr_revoff[i] > g->gr_revoff[i + 1])
+			return (-1);
+		g->gr_rank[n] = i;
+	}
+
+	return (0);
+}
+
+/*
+ * Index files hold a crawled graph so it can be queried or printed without
+ * crawling the repository again.  They consist of an index_header followed by
+ * the string table, the nodes, dependency groups, and edges, and the lookup
+ * arrays built by graph_index(), each padded to a multiple of 8 bytes.
+ * They're written in the native byte order, so they shouldn't be moved
+ * between machines of different architectures.
+ */
+
+#define	INDEX_MAGIC	"SCFDOTIX"
+#define	INDEX_VERSION	2	/* 2: E_SAMEENT and node states */
+
+struct index_header {
+	char		ih_magic[8];
+	uint32_t	ih_version;
+	uint32_t	ih_label;
+	uint32_t	ih_strsz;
+	uint32_t	ih_nnodes;
+	uint32_t	ih_ndgs;
+	uint32_t	ih_nedges;
+};
+
+#define	INDEX_PAD(sz)	(((sz) + 7) & ~(size_t)7)
+
+static void
+index_write(FILE *fp, const char *file, const void *buf, size_t sz)
+{
+	static const char zeros[8];
+
+	if ((sz != 0 && fwrite(buf, sz, 1, fp) != 1) ||
+	    (INDEX_PAD(sz) != sz &&
+	    fwrite(zeros, INDEX_PAD(sz) - sz, 1, fp) != 1)) {
+		perror(file);
+		exit(1);
+	}
+}
+
+static void *
+index_read(FILE *fp, const char *file, size_t sz)
+{
+	void *buf;
+
+	buf = safe_realloc(NULL, INDEX_PAD(sz) + 1);
+
+	if (fread(buf, INDEX_PAD(sz), 1, fp) != 1 && INDEX_PAD(sz) != 0) {
+		if (ferror(fp))
+			perror(file);
+		else
+			(void) fprintf(stderr, "%s: truncated index file\n",
+			    file);
+		exit(1);
+	}
+
+	return (buf);
+}
+
+static void
+graph_save(const struct graph *g, const char *file)
+{
+	struct index_header ih;
+	FILE *fp;
+
+	(void) memset(&ih, 0, sizeof (ih));
+	(void) memcpy(ih.ih_magic, INDEX_MAGIC, sizeof (ih.ih_magic));
+	ih.ih_version = INDEX_VERSION;
+	ih.ih_label = g->gr_label;
+	ih.ih_strsz = g->gr_strsz;
+	ih.ih_nnodes = g->gr_nnodes;
+	ih.ih_ndgs = g->gr_ndgs;
+	ih.ih_nedges = g->gr_nedges;
+
+	if ((fp = fopen(file, "wb")) == NULL) {
+		perror(file);
+		exit(1);
+	}
+
+	index_write(fp, file, &ih, sizeof (ih));
+	index_write(fp, file, g->gr_str, g->gr_strsz);
+	index_write(fp, file, g->gr_nodes, g->gr_nnodes * sizeof (struct node));
+	index_write(fp, file, g->gr_dgs,
+	    g->gr_ndgs * sizeof (struct depgroup));
+	index_write(fp, file, g->gr_edges,
+	    g->gr_nedges * sizeof (struct edge));
+	index_write(fp, file, g->gr_byname, g->gr_nnodes * sizeof (uint32_t));
+	index_write(fp, file, g->gr_revoff,
+	    (g->gr_nnodes + 1) * sizeof (uint32_t));
+	index_write(fp, file, g->gr_rev, g->gr_nedges * sizeof (uint32_t));
+
+	if (fclose(fp) != 0) {
+		perror(file);
+		exit(1);
+	}
+}
+
+static void
+graph_load(struct graph *g, const char *file)
+{
+	struct index_header ih;
+	FILE *fp;
+
+	if ((fp = fopen(file, "rb")) == NULL) {
+		perror(file);
+		exit(1);
+	}
+
+	if (fread(&ih, sizeof (ih), 1, fp) != 1 ||
+	    memcmp(ih.ih_magic, INDEX_MAGIC, sizeof (ih.ih_magic)) != 0) {
+		(void) fprintf(stderr, "%s: not a scfdot index file\n", file);
+		exit(1);
+	}
+
+	if (ih.ih_version != INDEX_VERSION) {
+		(void) fprintf(stderr, "%s: unsupported index version %u\n",
+		    file, ih.ih_version);
+		exit(1);
+	}
+
+	(void) memset(g, 0, sizeof (*g));
+	g->gr_label = ih.ih_label;
+	g->gr_strsz = g->gr_strcap = ih.ih_strsz;
+	g->gr_nnodes = g->gr_nodecap = ih.ih_nnodes;
+	g->gr_ndgs = g->gr_dgcap = ih.ih_ndgs;
+	g->gr_nedges = g->gr_edgecap = ih.ih_nedges;
+
+	g->gr_str = index_read(fp, file, ih.ih_strsz);
+	g->gr_nodes = index_read(fp, file, ih.ih_nnodes * sizeof (struct node));
+	g->gr_dgs = index_read(fp, file, ih.ih_ndgs * sizeof (struct depgroup));
+	g->gr_edges = index_read(fp, file,
+	    ih.ih_nedges * sizeof (struct edge));
+	g->gr_byname = index_read(fp, file, ih.ih_nnodes * sizeof (uint32_t));
+	g->gr_revoff = index_read(fp, file,
+	    (ih.ih_nnodes + 1) * sizeof (uint32_t));
+	g->gr_rev = index_read(fp, file, ih.ih_nedges * sizeof (uint32_t));
+
+	(void) fclose(fp);
+
+	g->gr_rank = safe_realloc(NULL, (g->gr_nnodes + 1) * sizeof (uint32_t));
+
+	if (index_check(g) != 0) {
+		(void) fprintf(stderr, "%s: corrupt index file\n", file);
+		exit(1);
+	}
+}
+
+/*
+ * Time-series logs (-T) hold a snapshot of the graph from each run, so the
+ * graph can be reconstructed as of some time in the past (-t).  A log is a
+ * tlog_header followed by records, each a tlog_record and its payload,
+ * compressed with zlib.  Every keyint-th record is a keyframe, which holds
+ * the whole graph; the others are deltas, which hold only the nodes which
+ * were added, removed, or changed since the previous record.  Runs which
+ * change nothing (but the label) add no record.
+ *
+ * A payload is text: an "L label" line, then the node records in FMRI order.
+ * A node record is an "N fmri" line followed by "F flags" and its dependency
+ * groups, each a "G grouping name" line followed by "E flags target" lines for
+ * its edges.  A delta also holds "- fmri" lines for the removed nodes.  Since
+ * a node record captures everything about the node, a changed node is simply
+ * replaced.  Like index files, logs are in the native byte order.
+ */
+
+#define	TLOG_MAGIC	"SCFDOTTL"
+#define	TLOG_VERSION	1
+#define	TLOG_KEYINT	16
+
+#define	TLOG_KEYFRAME	1
+#define	TLOG_DELTA	2
+
+struct tlog_header {
+	char		th_magic[8];
+	uint32_t	th_version;
+	uint32_t	th_pad;
+};
+
+struct tlog_record {
+	uint32_t	tr_type;	/* TLOG_KEYFRAME or TLOG_DELTA */
+	uint32_t	tr_clen;	/* compressed length of the payload */
+	uint32_t	tr_ulen;	/* uncompressed length */
+	uint32_t	tr_pad;
+	int64_t		tr_time;
+};
+
+/* A node record, or a "- fmri" line, in a payload. */
+struct tlog_rec {
+	const char	*r_text;
+	uint32_t	r_len;
+};
+
+/* A graph as node records, sorted by FMRI. */
+struct tlog_state {
+	const char	*ts_label;	/* "L label\n" */
+	uint32_t	ts_labellen;
+	struct tlog_rec	*ts_recs;
+	uint32_t	ts_nrecs, ts_reccap;
+	char		**ts_bufs;	/* payloads the records point into */
+	uint32_t	ts_nbufs, ts_bufcap;
+};
+
+/* Records read by tlog_scan(). */
+static struct tlog_record *tl_recs;
+static off_t *tl_offs;
+static uint32_t tl_nrecs, tl_cap;
+
+static char *tl_buf;		/* for building payloads */
+static uint32_t tl_len, tl_bufcap;
+
+static void
+tl_append(const char *str, size_t len)
+{
+	grow(&tl_buf, &tl_bufcap, tl_len, len, 1);
+	(void) memcpy(tl_buf + tl_len, str, len);
+	tl_len += len;
+}
+
+/*
+ * Append a payload line: tag, num if tag has a %u, and str.
+ */
+static void
+tl_line(const char *tag, uint32_t num, const char *str)
+{
+	char buf[16];
+
+	if (strchr(tag, '%') != NULL) {
+		(void) snprintf(buf, sizeof (buf), tag, num);
+		tag = buf;
+	}
+	tl_append(tag, strlen(tag));
+	tl_append(str, strlen(str));
+	tl_append("\n", 1);
+}
+
+/*
+ * Compare the FMRIs of two records (or "- fmri" lines).
+ */
+static int
+tlog_rec_cmp(const struct tlog_rec *a, const struct tlog_rec *b)
+{
+	const uint8_t *p = (const uint8_t *)a->r_text + 2;
+	const uint8_t *q = (const uint8_t *)b->r_text + 2;
+
+	for (; *p == *q && *p != '\n'; ++p, ++q)
+		;
+
+	if (*p == *q)
+		return (0);
+	if (*p == '\n' || (*q != '\n' && *p < *q))
+		return (-1);
+	return (1);
+}
+
+static void
+tlog_add_rec(struct tlog_state *s, const char *text, uint32_t len)
+{
+	grow(&s->ts_recs, &s->ts_reccap, s->ts_nrecs, 1,
+	    sizeof (struct tlog_rec));
+	s->ts_recs[s->ts_nrecs].r_text = text;
+	s->ts_recs[s->ts_nrecs].r_len = len;
+	++s->ts_nrecs;
+}
+
+static void
+tlog_add_buf(struct tlog_state *s, char *buf)
+{
+	grow(&s->ts_bufs, &s->ts_bufcap, s->ts_nbufs, 1, sizeof (char *));
+	s->ts_bufs[s->ts_nbufs++] = buf;
+}
+
+static void
+tlog_free(struct tlog_state *s)
+{
+	uint32_t i;
+
+	for (i = 0; i < s->ts_nbufs; ++i)
+		free(s->ts_bufs[i]);
+	free(s->ts_bufs);
+	free(s->ts_recs);
+	(void) memset(s, 0, sizeof (*s));
+}
+
+/*
+ * Serialize g into s.
+ */
+static void
+tlog_from_graph(const struct graph *g, struct tlog_state *s)
+{
+	uint32_t i, d, e, *starts;
+
+	(void) memset(s, 0, sizeof (*s));
+	tl_buf = NULL;
+	tl_len = tl_bufcap = 0;
+	starts = safe_realloc(NULL, (g->gr_nnodes + 1) * sizeof (uint32_t));
+
+	tl_line("L ", 0, GSTR(g, g->gr_label));
+
+	for (i = 0; i < g->gr_nnodes; ++i) {
+		uint32_t n = g->gr_byname[i];
+		const struct node *np = &g->gr_nodes[n];
+
+		starts[i] = tl_len;
+		tl_line("N ", 0, NODE_FMRI(g, n));
+		tl_line("F %u", np->n_flags, "");
+
+		for (d = np->n_dg; d < np->n_dg + np->n_ndgs; ++d) {
+			const struct depgroup *dgp = &g->gr_dgs[d];
+
+			tl_line("G %u ", dgp->dg_grouping,
+			    GSTR(g, dgp->dg_name));
+			for (e = dgp->dg_edge;
+			    e < dgp->dg_edge + dgp->dg_nedges; ++e)
+				tl_line("E %u ", g->gr_edges[e].e_flags,
+				    NODE_FMRI(g, g->gr_edges[e].e_to));
+		}
+	}
+	starts[g->gr_nnodes] = tl_len;
+
+	tlog_add_buf(s, tl_buf);
+	s->ts_label = tl_buf;
+	s->ts_labellen = starts[0];
+	for (i = 0; i < g->gr_nnodes; ++i)
+		tlog_add_rec(s, tl_buf + starts[i], starts[i + 1] - starts[i]);
+
+	free(starts);
+}
+
+/*
+ * Split payload buf, of len bytes, into its label and records, which are
+ * added to s.  s takes ownership of buf.  Returns -1 if it's malformed.
+ */
+static int
+tlog_parse(struct tlog_state *s, char *buf, uint32_t len)
+{
+	char *p = buf, *end = buf + len, *rec = NULL;
+
+	tlog_add_buf(s, buf);
+
+	if (len < 2 || buf[len - 1] != '\n' || strncmp(buf, "L ", 2) != 0)
+		return (-1);
+
+	while (p < end) {
+		char *nl = memchr(p, '\n', end - p);
+
+		if (p == buf) {
+			s->ts_label = buf;
+			s->ts_labellen = nl + 1 - buf;
+		} else if (p[0] == 'N' || p[0] == '-') {
+			if (rec != NULL)
+				tlog_add_rec(s, rec, p - rec);
+			rec = p;
+		} else if (rec == NULL || rec[0] == '-') {
+			return (-1);
+		}
+		p = nl + 1;
+	}
+	if (rec != NULL)
+		tlog_add_rec(s, rec, end - rec);
+
+	return (0);
+}
+
+/*
+ * Apply delta to s: replace the records of changed nodes, add those of new
+ * ones, and remove those named by "- fmri" lines.
+ */
+static void
+tlog_apply(struct tlog_state *s, struct tlog_state *delta)
+{
+	struct tlog_rec *old = s->ts_recs;
+	uint32_t nold = s->ts_nrecs, i = 0, j = 0;
+
+	s->ts_recs = NULL;
+	s->ts_nrecs = s->ts_reccap = 0;
+
+	while (i < nold || j < delta->ts_nrecs) {
+		const struct tlog_rec *dr = &delta->ts_recs[j];
+		int c;
+
+		if (i == nold)
+			c = 1;
+		else if (j == delta->ts_nrecs)
+			c = -1;
+		else
+			c = tlog_rec_cmp(&old[i], dr);
+
+		if (c < 0) {
+			tlog_add_rec(s, old[i].r_text, old[i].r_len);
+			++i;
+			continue;
+		}
+
+		if (dr->r_text[0] == 'N')
+			tlog_add_rec(s, dr->r_text, dr->r_len);
+		if (c == 0)
+			++i;
+		++j;
+	}
+
+	free(old);
+
+	s->ts_label = delta->ts_label;
+	s->ts_labellen = delta->ts_labellen;
+	for (i = 0; i < delta->ts_nbufs; ++i)
+		tlog_add_buf(s, delta->ts_bufs[i]);
+	delta->ts_nbufs = 0;
+	tlog_free(delta);
+}
+
+/*
+ * Build the delta from old to new in tl_buf.  Returns the number of nodes
+ * added, removed, or changed.
+ */
+static uint32_t
+tlog_diff(const struct tlog_state *old, const struct tlog_state *new)
+{
+	uint32_t i = 0, j = 0, nchanged = 0;
+
+	tl_buf = NULL;
+	tl_len = tl_bufcap = 0;
+	tl_append(new->ts_label, new->ts_labellen);
+
+	while (i < old->ts_nrecs || j < new->ts_nrecs) {
+		const struct tlog_rec *orec = &old->ts_recs[i];
+		const struct tlog_rec *nrec = &new->ts_recs[j];
+		int c;
+
+		if (i == old->ts_nrecs)
+			c = 1;
+		else if (j == new->ts_nrecs)
+			c = -1;
+		else
+			c = tlog_rec_cmp(orec, nrec);
+
+		if (c < 0) {
+			const char *nl = memchr(orec->r_text, '\n',
+			    orec->r_len);
+
+			tl_append("- ", 2);
+			tl_append(orec->r_text + 2,
+			    nl + 1 - (orec->r_text + 2));
+			++nchanged;
+			++i;
+			continue;
+		}
+
+		if (c > 0 || orec->r_len != nrec->r_len ||
+		    memcmp(orec->r_text, nrec->r_text, nrec->r_len) != 0) {
+			tl_append(nrec->r_text, nrec->r_len);
+			++nchanged;
+		}
+		if (c == 0)
+			++i;
+		++j;
+	}
+
+	return (nchanged);
+}
+
+/*
+ * Add what line, of a record, says to g.  *np and *dgp are the node and
+ * dependency group of the lines before it, or NO_NODE.  Returns -1 if the
+ * line doesn't make sense there (a dependency group before its node, an edge
+ * before its group, a bad grouping, or a node given twice).
+ */
+static int
+tlog_graph_line(struct graph *g, const char *line, uint32_t *np,
+    uint32_t *dgp)
+{
+	char *arg;
+	uint32_t num;
+
+	if (line[0] == 'N') {
+		if (line[1] != ' ' || line[2] == '\0')
+			return (-1);
+		*np = node_lookup(g, line + 2, 1);
+		*dgp = NO_NODE;
+		return (g->gr_nodes[*np].n_flags != 0 ||
+		    g->gr_nodes[*np].n_ndgs != 0 ? -1 : 0);
+	}
+
+	if (line[0] != 'F' && line[0] != 'G' && line[0] != 'E')
+		return (0);
+
+	num = strtoul(line + 2, &arg, 10);
+	if (line[1] != ' ' || arg == line + 2 ||
+	    *arg != (line[0] == 'F' ? '\0' : ' '))
+		return (-1);
+	if (*arg == ' ')
+		++arg;
+
+	switch (line[0]) {
+	case 'F':
+		if (*np == NO_NODE || N_STATE(num) >= NSTATES)
+			return (-1);
+		g->gr_nodes[*np].n_flags = num;
+		break;
+	case 'G':
+		if (*np == NO_NODE || num >= NGROUPINGS)
+			return (-1);
+		*dgp = graph_add_dg(g, *np, arg, num);
+		break;
+	case 'E':
+		if (*dgp == NO_NODE || *arg == '\0')
+			return (-1);
+		graph_add_edge(g, *dgp, node_lookup(g, arg, 1), num);
+		break;
+	}
+
+	return (0);
+}
+
+/*
+ * Build a graph from the records in s.  The nodes are numbered in FMRI
+ * order, rather than the order the repository was crawled in.  Returns -1 if
+ * the records are corrupt.
+ */
+static int
+tlog_to_graph(const struct tlog_state *s, struct graph *g)
+{
+	char *line = NULL;
+	uint32_t linecap = 0, i, n = NO_NODE, dg = NO_NODE;
+	int ret = 0;
+
+	(void) memset(g, 0, sizeof (*g));
+
+	grow(&line, &linecap, 0, s->ts_labellen, 1);
+	(void) memcpy(line, s->ts_label + 2, s->ts_labellen - 2);
+	line[s->ts_labellen - 3] = '\0';
+	g->gr_label = str_intern(g, line);
+
+	for (i = 0; i < s->ts_nrecs && ret == 0; ++i) {
+		const char *p = s->ts_recs[i].r_text;
+		const char *end = p + s->ts_recs[i].r_len;
+
+		while (p < end && ret == 0) {
+			const char *nl = memchr(p, '\n', end - p);
+
+			grow(&line, &linecap, 0, nl - p + 1, 1);
+			(void) memcpy(line, p, nl - p);
+			line[nl - p] = '\0';
+			p = nl + 1;
+
+			ret = tlog_graph_line(g, line, &n, &dg);
+		}
+	}
+
+	free(line);
+	if (ret == 0)
+		graph_index(g);
+	return (ret);
+}
+
+/*
+ * Open log, creating it if create is set, and read the headers of its
+ * records into tl_recs and tl_offs.  A record cut short (by a crash, say)
+ * ends the log; if create is set, it's truncated away.  A record header which
+ * can't have been written by tlog_append() also ends the log, but since what
+ * follows it may be intact, we refuse to append to such a log rather than
+ * truncate it.
+ */
+static FILE *
+tlog_scan(const char *file, int create)
+{
+	struct tlog_header th;
+	struct tlog_record tr;
+	FILE *fp;
+	off_t off, end;
+	int corrupt = 0;
+
+	if ((fp = fopen(file, create ? "a+b" : "rb")) == NULL) {
+		perror(file);
+		exit(1);
+	}
+
+	if (fseeko(fp, 0, SEEK_END) != 0 || (end = ftello(fp)) == -1 ||
+	    fseeko(fp, 0, SEEK_SET) != 0) {
+		perror(file);
+		exit(1);
+	}
+
+	if (end == 0 && create) {
+		(void) memset(&th, 0, sizeof (th));
+		(void) memcpy(th.th_magic, TLOG_MAGIC, sizeof (th.th_magic));
+		th.th_version = TLOG_VERSION;
+		if (fwrite(&th, sizeof (th), 1, fp) != 1 || fflush(fp) != 0) {
+			perror(file);
+			exit(1);
+		}
+		end = sizeof (th);
+		(void) fseeko(fp, 0, SEEK_SET);
+	}
+
+	if (fread(&th, sizeof (th), 1, fp) != 1 ||
+	    memcmp(th.th_magic, TLOG_MAGIC, sizeof (th.th_magic)) != 0) {
+		(void) fprintf(stderr, "%s: not a scfdot log file\n", file);
+		exit(1);
+	}
+
+	if (th.th_version != TLOG_VERSION) {
+		(void) fprintf(stderr, "%s: unsupported log version %u\n",
+		    file, th.th_version);
+		exit(1);
+	}
+
+	tl_nrecs = 0;
+	for (off = sizeof (th); off < end; ) {
+		if (fseeko(fp, off, SEEK_SET) != 0 ||
+		    fread(&tr, sizeof (tr), 1, fp) != 1)
+			break;
+
+		if ((tr.tr_type != TLOG_KEYFRAME && tr.tr_type != TLOG_DELTA) ||
+		    tr.tr_pad != 0 || tr.tr_clen > compressBound(tr.tr_ulen)) {
+			corrupt = 1;
+			break;
+		}
+
+		if (off + (off_t)sizeof (tr) + tr.tr_clen > end)
+			break;
+
+		if (tl_nrecs == tl_cap) {
+			grow(&tl_recs, &tl_cap, tl_nrecs, 1,
+			    sizeof (*tl_recs));
+			tl_offs = safe_realloc(tl_offs,
+			    tl_cap * sizeof (off_t));
+		}
+		tl_recs[tl_nrecs] = tr;
+		tl_offs[tl_nrecs++] = off + sizeof (tr);
+		off += sizeof (tr) + tr.tr_clen;
+	}
+
+	if (corrupt) {
+		(void) fprintf(stderr, "%s: corrupt record header at offset "
+		    "%lld\n", file, (long long)off);
+		if (create)
+			exit(1);
+		(void) fprintf(stderr, "%s: ignoring the records from there "
+		    "on\n", file);
+	} else if (off != end) {
+		(void) fprintf(stderr, "%s: ignoring truncated record at "
+		    "offset %lld\n", file, (long long)off);
+		if (create && ftruncate(fileno(fp), off) != 0) {
+			perror(file);
+			exit(1);
+		}
+	}
+
+	return (fp);
+}
+
+/*
+ * Read and decompress record r of the log open on fp, and add it to s.
+ */
+static void
+tlog_read(FILE *fp, const char *file, uint32_t r, struct tlog_state *s)
+{
+	const struct tlog_record *tr = &tl_recs[r];
+	char *cbuf, *ubuf;
+	uLongf ulen = tr->tr_ulen;
+
+	cbuf = safe_realloc(NULL, tr->tr_clen + 1);
+	ubuf = safe_realloc(NULL, tr->tr_ulen + 1);
+
+	if (fseeko(fp, tl_offs[r], SEEK_SET) != 0 ||
+	    fread(cbuf, tr->tr_clen, 1, fp) != 1) {
+		perror(file);
+		exit(1);
+	}
+
+	if (uncompress((Bytef *)ubuf, &ulen, (Bytef *)cbuf, tr->tr_clen) !=
+	    Z_OK || ulen != tr->tr_ulen ||
+	    tlog_parse(s, ubuf, tr->tr_ulen) != 0) {
+		(void) fprintf(stderr, "%s: corrupt record at offset %lld\n",
+		    file, (long long)tl_offs[r]);
+		exit(1);
+	}
+
+	free(cbuf);
+}
+
+/*
+ * Reconstruct the graph as of record last into s, starting from the
+ * keyframe before it.
+ */
+static void
+tlog_state_at(FILE *fp, const char *file, uint32_t last,
+    struct tlog_state *s)
+{
+	uint32_t r;
+
+	for (r = last; tl_recs[r].tr_type != TLOG_KEYFRAME; --r) {
+		if (r == 0) {
+			(void) fprintf(stderr, "%s: no keyframe\n", file);
+			exit(1);
+		}
+	}
+
+	(void) memset(s, 0, sizeof (*s));
+	tlog_read(fp, file, r, s);
+
+	while (++r <= last) {
+		struct tlog_state delta;
+
+		(void) memset(&delta, 0, sizeof (delta));
+		tlog_read(fp, file, r, &delta);
+		tlog_apply(s, &delta);
+	}
+}
+
+/*
+ * Append g to log, as a keyframe if the last one was keyint records ago.
+ */
+static void
+tlog_append(const struct graph *g, const char *file, uint32_t keyint)
+{
+	struct tlog_state cur, prev;
+	struct tlog_record tr;
+	uint32_t r, sincekey = keyint, nchanged;
+	uLongf clen;
+	char *cbuf;
+	FILE *fp;
+
+	fp = tlog_scan(file, 1);
+	tlog_from_graph(g, &cur);
+
+	for (r = tl_nrecs; r > 0; --r) {
+		if (tl_recs[r - 1].tr_type == TLOG_KEYFRAME) {
+			sincekey = tl_nrecs - r + 1;
+			break;
+		}
+	}
+
+	(void) memset(&tr, 0, sizeof (tr));
+	tr.tr_time = time(NULL);
+
+	if (sincekey >= keyint) {
+		/* tlog_from_graph() left the payload in tl_buf. */
+		tr.tr_type = TLOG_KEYFRAME;
+		nchanged = cur.ts_nrecs;
+	} else {
+		tlog_state_at(fp, file, tl_nrecs - 1, &prev);
+		tr.tr_type = TLOG_DELTA;
+		nchanged = tlog_diff(&prev, &cur);
+		tlog_free(&prev);
+		if (nchanged == 0) {
+			if (print_stats)
+				(void) fprintf(stderr, "no changes; nothing "
+				    "logged\n");
+			free(tl_buf);
+			tlog_free(&cur);
+			(void) fclose(fp);
+			return;
+		}
+	}
+
+	clen = compressBound(tl_len);
+	cbuf = safe_realloc(NULL, clen);
+	if (compress2((Bytef *)cbuf, &clen, (Bytef *)tl_buf, tl_len,
+	    Z_BEST_COMPRESSION) != Z_OK) {
+		(void) fprintf(stderr, "%s: compression failed\n", file);
+		exit(1);
+	}
+	tr.tr_clen = clen;
+	tr.tr_ulen = tl_len;
+
+	if (fseeko(fp, 0, SEEK_END) != 0 ||
+	    fwrite(&tr, sizeof (tr), 1, fp) != 1 ||
+	    fwrite(cbuf, clen, 1, fp) != 1 || fclose(fp) != 0) {
+		perror(file);
+		exit(1);
+	}
+
+	if (print_stats)
+		(void) fprintf(stderr, "logged %s of %u nodes: %u bytes, "
+		    "%lu compressed\n", tr.tr_type == TLOG_KEYFRAME ?
+		    "keyframe" : "delta", nchanged, tl_len,
+		    (unsigned long)clen);
+
+	if (tr.tr_type == TLOG_DELTA)
+		free(tl_buf);
+	free(cbuf);
+	tlog_free(&cur);
+}
+
+/*
+ * Reconstruct the graph as of when into g, from the last record of log at or
+ * before then.
+ */
+static void
+tlog_replay(struct graph *g, const char *file, time_t when)
+{
+	struct tlog_state s;
+	uint32_t r;
+	FILE *fp;
+
+	fp = tlog_scan(file, 0);
+
+	for (r = 0; r < tl_nrecs && tl_recs[r].tr_time <= when; ++r)
+		;
+
+	if (r == 0) {
+		(void) fprintf(stderr, "%s: no snapshot at or before %lld\n",
+		    file, (long long)when);
+		exit(1);
+	}
+
+	tlog_state_at(fp, file, r - 1, &s);
+	(void) fclose(fp);
+
+	if (tlog_to_graph(&s, g) != 0) {
+		(void) fprintf(stderr, "%s: corrupt snapshot at %lld\n", file,
+		    (long long)tl_recs[r - 1].tr_time);
+		exit(1);
+	}
+	tlog_free(&s);
+}
+
+/*
+ * Parse a time for -t: seconds since the epoch, or a local date and time.
+ */
+static time_t
+parse_time(const char *str)
+{
+	static const char * const fmts[] = {
+		"%Y-%m-%d %H:%M:%S", "%Y-%m-%d %H:%M", "%Y-%m-%d", NULL
+	};
+	const char * const *fmt;
+	struct tm tm;
+	char *end;
+	long long secs;
+
+	secs = strtoll(str, &end, 10);
+	if (end != str && *end == '\0')
+		return ((time_t)secs);
+
+	for (fmt = fmts; *fmt != NULL; ++fmt) {
+		(void) memset(&tm, 0, sizeof (tm));
+		end = strptime(str, *fmt, &tm);
+		if (end != NULL && *end == '\0') {
+			tm.tm_isdst = -1;
+			return (mktime(&tm));
+		}
+	}
+
+	return ((time_t)-1);
+}
+
+/*
+ * Queries.  Each is a line of the form
+ *
+ *	dependencies|dependents[*] fmri [grouping[,grouping]...]
+ *
+ * and is answered by printing the FMRIs of fmri's direct dependencies or
+ * dependents (or all of them, with *), in order.  If groupings are given,
+ * only dependency groups with those groupings ("restarter" included) are
+ * followed.
+ */
+
+#define	QUERY_MAX	4096
+
+static uint32_t *q_list;	/* BFS queue, and then the answer */
+static uint32_t *q_mark;	/* == q_stamp if already in q_list */
+static uint32_t q_stamp;
+
+static int
+rank_cmp(const void *a, const void *b)
+{
+	uint32_t ra = sort_graph->gr_rank[*(const uint32_t *)a];
+	uint32_t rb = sort_graph->gr_rank[*(const uint32_t *)b];
+
+	return (ra < rb ? -1 : ra > rb);
+}
+
+/*
+ * Answer one query.  Returns 0 on success and -1 if the query is malformed
+ * or names an unknown instance.
+ */
+static int
+run_query(const struct graph *g, char *line)
+{
+	char fmribuf[QUERY_MAX];
+	char *op, *qfmri, *tok;
+	uint_t mask = 0;
+	int reverse, transitive;
+	uint32_t start, head, tail, i;
+	size_t oplen;
+
+	if ((op = strtok(line, " \t\n")) == NULL ||
+	    (qfmri = strtok(NULL, " \t\n")) == NULL) {
+		(void) fputs("query must be \"dependencies|dependents[*] fmri "
+		    "[grouping,...]\"\n", stderr);
+		return (-1);
+	}
+
+	oplen = strlen(op);
+	transitive = (op[oplen - 1] == '*');
+	if (transitive)
+		op[--oplen] = '\0';
+
+	if (strcmp(op, "dependencies") == 0) {
+		reverse = 0;
+	} else if (strcmp(op, "dependents") == 0) {
+		reverse = 1;
+	} else {
+		(void) fprintf(stderr, "unknown query \"%s\"\n", op);
+		return (-1);
+	}
+
+	while ((tok = strtok(NULL, " \t,\n")) != NULL) {
+		for (i = 0; i < NGROUPINGS; ++i) {
+			if (strcmp(tok, groupings[i].name) == 0)
+				break;
+		}
+		if (i == NGROUPINGS) {
+			(void) fprintf(stderr, "unknown grouping \"%s\"\n",
+			    tok);
+			return (-1);
+		}
+		mask |= 1U << i;
+	}
+	if (mask == 0)
+		mask = G_ALL;
+
+	if (strncmp(qfmri, "svc:", sizeof ("svc:") - 1) != 0) {
+		(void) snprintf(fmribuf, sizeof (fmribuf), "svc:/%s", qfmri);
+		qfmri = fmribuf;
+	}
+
+	if ((start = graph_find(g, qfmri)) == NO_NODE) {
+		(void) fprintf(stderr, "%s: no such instance\n", qfmri);
+		return (-1);
+	}
+
+	if (++q_stamp == 0) {
+		(void) memset(q_mark, 0, g->gr_nnodes * sizeof (uint32_t));
+		q_stamp = 1;
+	}
+
+	q_mark[start] = q_stamp;
+	head = tail = 0;
+	q_list[tail++] = start;
+
+	while (head < tail) {
+		uint32_t n = q_list[head++];
+		uint32_t e, end;
+
+		if (!transitive && n != start)
+			break;
+
+		if (reverse) {
+			e = g->gr_revoff[n];
+			end = g->gr_revoff[n + 1];
+		} else {
+			node_edges(g, n, &e, &end);
+		}
+
+		for (; e < end; ++e) {
+			const struct edge *ep =
+			    &g->gr_edges[reverse ? g->gr_rev[e] : e];
+			const struct depgroup *dgp = &g->gr_dgs[ep->e_dg];
+			uint32_t next = reverse ? dgp->dg_node : ep->e_to;
+
+			if (!(mask & (1U << dgp->dg_grouping)) ||
+			    q_mark[next] == q_stamp)
+				continue;
+
+			q_mark[next] = q_stamp;
+			q_list[tail++] = next;
+		}
+	}
+
+	/* Skip the start node. */
+	sort_graph = g;
+	qsort(q_list + 1, tail - 1, sizeof (uint32_t), rank_cmp);
+	for (i = 1; i < tail; ++i)
+		(void) puts(NODE_FMRI(g, q_list[i]));
+
+	return (0);
+}
+
+/*
+ * Answer query, or if query is "-", each line of the standard input as a
+ * query, with a blank line after each answer.  Returns the exit status.
+ */
+static int
+run_queries(const struct graph *g, const char *query)
+{
+	char line[QUERY_MAX];
+	int ret = 0;
+
+	q_list = safe_realloc(NULL, (g->gr_nnodes + 1) * sizeof (uint32_t));
+	if ((q_mark = calloc(g->gr_nnodes + 1, sizeof (uint32_t))) == NULL) {
+		perror("calloc");
+		exit(1);
+	}
+
+	if (strcmp(query, "-") != 0) {
+		(void) strlcpy(line, query, sizeof (line));
+		return (run_query(g, line) == 0 ? 0 : 1);
+	}
+
+	while (fgets(line, sizeof (line), stdin) != NULL) {
+		if (line[strspn(line, " \t\n")] == '\0')
+			continue;
+		if (run_query(g, line) != 0)
+			ret = 1;
+		(void) putchar('\n');
+	}
+
+	return (ret);
+}
+
+/*
+ * Graph comparison (-c).  Both graphs are walked in FMRI order, which their
+ * indexes already provide, so each node is paired with its counterpart (if
+ * any) in a single merge pass.  The edges of each pair of nodes are sorted by
+ * dependency group name and target FMRI and merged the same way.  The result
+ * is printed as one dot graph with the unchanged parts faded and the
+ * differences highlighted, and summarized on the standard error.
+ */
+
+#define	DIFF_ADDED	"#1A9641"
+#define	DIFF_REMOVED	"#D7191C"
+#define	DIFF_CHANGED	"#7B3294"
+
+typedef enum diff_status {
+	D_UNCHANGED,
+	D_ADDED,
+	D_REMOVED,
+	D_CHANGED
+} diff_status_t;
+
+static const char * const diff_names[] = {
+	"unchanged", "added", "removed", "changed"
+};
+
+static const char diff_marks[] = { ' ', '+', '-', '~' };
+
+static uint32_t diff_nodes[4], diff_edges[4];
+
+static uint32_t *diff_old_edges, *diff_new_edges;
+
+static int
+edge_cmp(const struct graph *ga, uint32_t ea, const struct graph *gb,
+    uint32_t eb)
+{
+	const struct edge *a = &ga->gr_edges[ea];
+	const struct edge *b = &gb->gr_edges[eb];
+	int c;
+
+	if ((c = strcmp(GSTR(ga, ga->gr_dgs[a->e_dg].dg_name),
+	    GSTR(gb, gb->gr_dgs[b->e_dg].dg_name))) != 0)
+		return (c);
+
+	return (strcmp(NODE_FMRI(ga, a->e_to), NODE_FMRI(gb, b->e_to)));
+}
+
+static int
+edge_sort_cmp(const void *a, const void *b)
+{
+	return (edge_cmp(sort_graph, *(const uint32_t *)a, sort_graph,
+	    *(const uint32_t *)b));
+}
+
+/*
+ * Fill in edges with node n's edges, sorted, and return how many there are.
+ */
+static uint32_t
+sorted_edges(const struct graph *g, uint32_t n, uint32_t *edges)
+{
+	uint32_t e, end, cnt = 0;
+
+	if (n == NO_NODE)
+		return (0);
+
+	for (node_edges(g, n, &e, &end); e < end; ++e)
+		edges[cnt++] = e;
+
+	sort_graph = g;
+	qsort(edges, cnt, sizeof (uint32_t), edge_sort_cmp);
+
+	return (cnt);
+}
+
+/*
+ * Return whether crawled node a of ga differs from crawled node b of gb,
+ * apart from its edges.
+ */
+static int
+node_changed(const struct graph *ga, uint32_t a, const struct graph *gb,
+    uint32_t b)
+{
+	const struct node *na = &ga->gr_nodes[a];
+	const struct node *nb = &gb->gr_nodes[b];
+	uint32_t i;
+
+	if ((na->n_flags & (N_ENABLED | N_STATE_MASK)) !=
+	    (nb->n_flags & (N_ENABLED | N_STATE_MASK)) ||
+	    na->n_ndgs != nb->n_ndgs)
+		return (1);
+
+	for (i = 0; i < na->n_ndgs; ++i) {
+		const struct depgroup *da = &ga->gr_dgs[na->n_dg + i];
+		const struct depgroup *db = &gb->gr_dgs[nb->n_dg + i];
+
+		if (da->dg_grouping != db->dg_grouping ||
+		    strcmp(GSTR(ga, da->dg_name), GSTR(gb, db->dg_name)) != 0)
+			return (1);
+	}
+
+	return (0);
+}
+
+/*
+ * Print the node for fmri, with the ports of both nodes, either of which may
+ * be NO_NODE.
+ */
+static void
+print_diff_node(const struct graph *og, uint32_t on, const struct graph *ng,
+    uint32_t nn, diff_status_t st)
+{
+	const char *nfmri = nn != NO_NODE ? NODE_FMRI(ng, nn) :
+	    NODE_FMRI(og, on);
+	const char * const *colors;
+	uint32_t d;
+
+	allpgs[0] = '\0';
+
+	if (nn != NO_NODE) {
+		const struct node *np = &ng->gr_nodes[nn];
+
+		for (d = np->n_dg; d < np->n_dg + np->n_ndgs; ++d)
+			add_dep(GSTR(ng, ng->gr_dgs[d].dg_name));
+	}
+
+	if (on != NO_NODE) {
+		const struct node *np = &og->gr_nodes[on];
+
+		for (d = np->n_dg; d < np->n_dg + np->n_ndgs; ++d) {
+			const char *name = GSTR(og, og->gr_dgs[d].dg_name);
+			const struct node *newp;
+			uint32_t i;
+
+			if (nn != NO_NODE) {
+				newp = &ng->gr_nodes[nn];
+				for (i = newp->n_dg;
+				    i < newp->n_dg + newp->n_ndgs; ++i) {
+					if (strcmp(name, GSTR(ng,
+					    ng->gr_dgs[i].dg_name)) == 0)
+						break;
+				}
+				if (i < newp->n_dg + newp->n_ndgs)
+					continue;
+			}
+
+			add_dep(name);
+		}
+	}
+
+	if (allpgs[0] != '\0')
+		allpgs[strlen(allpgs) - 1] = '\0';	/* nuke trailing | */
+
+	colors = choose_color(nfmri, st != D_UNCHANGED && (nn != NO_NODE ?
+	    ng->gr_nodes[nn].n_flags : og->gr_nodes[on].n_flags) & N_ENABLED);
+
+	(void) printf("\"%s\" [shape=record,color=\"%s\",style=\"filled%s\","
+	    "fillcolor=\"%s\",fontcolor=\"%s\"", nfmri,
+	    st == D_ADDED ? DIFF_ADDED : st == D_REMOVED ? DIFF_REMOVED :
+	    st == D_CHANGED ? DIFF_CHANGED : colors[0],
+	    st == D_REMOVED ? ",dashed" : "", colors[1], colors[0]);
+	if (st != D_UNCHANGED)
+		(void) fputs(",penwidth=3", stdout);
+
+	if (allpgs[0] != '\0')
+		(void) printf(",label=\"{<foo> %s | {%s}}\"];\n",
+		    nfmri + sizeof ("svc:/") - 1, allpgs);
+	else
+		(void) printf(",label=\"%s\"];\n",
+		    nfmri + sizeof ("svc:/") - 1);
+}
+
+static void
+print_diff_edge(const struct graph *g, uint32_t e, diff_status_t st)
+{
+	const struct edge *ep = &g->gr_edges[e];
+	const struct depgroup *dgp = &g->gr_dgs[ep->e_dg];
+	const char *gopts = groupings[dgp->dg_grouping].opts;
+	char opts[100];
+
+	(void) snprintf(opts, sizeof (opts), "%s%scolor=\"%s\"%s", gopts,
+	    gopts[0] != '\0' ? "," : "",
+	    st == D_ADDED ? DIFF_ADDED : st == D_REMOVED ? DIFF_REMOVED :
+	    st == D_CHANGED ? DIFF_CHANGED : LTBLACK,
+	    st == D_UNCHANGED ? "" : ",penwidth=2");
+
+	print_dependency(NODE_FMRI(g, dgp->dg_node), GSTR(g, dgp->dg_name),
+	    NODE_FMRI(g, ep->e_to), opts,
+	    groupings[dgp->dg_grouping].weight);
+
+	++diff_edges[st];
+	if (st != D_UNCHANGED)
+		(void) fprintf(stderr, "%c %s -> %s (%s, %s)\n", diff_marks[st],
+		    NODE_FMRI(g, dgp->dg_node), NODE_FMRI(g, ep->e_to),
+		    GSTR(g, dgp->dg_name), groupings[dgp->dg_grouping].name);
+}
+
+/*
+ * Print and summarize the edges of node on of og and node nn of ng, either of
+ * which may be NO_NODE.
+ */
+static void
+diff_node_edges(const struct graph *og, uint32_t on, const struct graph *ng,
+    uint32_t nn)
+{
+	uint32_t ocnt, ncnt, i = 0, j = 0;
+
+	ocnt = sorted_edges(og, on, diff_old_edges);
+	ncnt = sorted_edges(ng, nn, diff_new_edges);
+
+	while (i < ocnt || j < ncnt) {
+		int c;
+
+		if (i == ocnt)
+			c = 1;
+		else if (j == ncnt)
+			c = -1;
+		else
+			c = edge_cmp(og, diff_old_edges[i], ng,
+			    diff_new_edges[j]);
+
+		if (c < 0) {
+			print_diff_edge(og, diff_old_edges[i++], D_REMOVED);
+		} else if (c > 0) {
+			print_diff_edge(ng, diff_new_edges[j++], D_ADDED);
+		} else {
+			uint32_t odg = og->gr_edges[diff_old_edges[i]].e_dg;
+			uint32_t ndg = ng->gr_edges[diff_new_edges[j]].e_dg;
+
+			print_diff_edge(ng, diff_new_edges[j],
+			    og->gr_dgs[odg].dg_grouping ==
+			    ng->gr_dgs[ndg].dg_grouping ?
+			    D_UNCHANGED : D_CHANGED);
+			++i;
+			++j;
+		}
+	}
+}
+
+/*
+ * Print a dot file comparing og, the old graph, with ng, the new one.
+ */
+static void
+print_diff(const struct graph *og, const struct graph *ng, const char *size)
+{
+	uint32_t i = 0, j = 0, d;
+
+	diff_old_edges = safe_realloc(NULL,
+	    (og->gr_nedges + 1) * sizeof (uint32_t));
+	diff_new_edges = safe_realloc(NULL,
+	    (ng->gr_nedges + 1) * sizeof (uint32_t));
+
+	(void) printf("digraph scf {\n");
+	(void) printf("label=\"%s\\nchanges since\\n%s\";\n",
+	    GSTR(ng, ng->gr_label), GSTR(og, og->gr_label));
+	print_graph_settings(size);
+	(void) putchar('\n');
+
+	while (i < og->gr_nnodes || j < ng->gr_nnodes) {
+		uint32_t on = NO_NODE, nn = NO_NODE;
+		diff_status_t st;
+		int c;
+
+		if (i == og->gr_nnodes)
+			c = 1;
+		else if (j == ng->gr_nnodes)
+			c = -1;
+		else
+			c = strcmp(NODE_FMRI(og, og->gr_byname[i]),
+			    NODE_FMRI(ng, ng->gr_byname[j]));
+
+		if (c <= 0)
+			on = og->gr_byname[i++];
+		if (c >= 0)
+			nn = ng->gr_byname[j++];
+
+		/* Only crawled nodes count. */
+		if (on != NO_NODE && !(og->gr_nodes[on].n_flags & N_CRAWLED))
+			on = NO_NODE;
+		if (nn != NO_NODE && !(ng->gr_nodes[nn].n_flags & N_CRAWLED))
+			nn = NO_NODE;
+
+		if (on == NO_NODE && nn == NO_NODE)
+			continue;
+
+		if (on == NO_NODE)
+			st = D_ADDED;
+		else if (nn == NO_NODE)
+			st = D_REMOVED;
+		else if (node_changed(og, on, ng, nn))
+			st = D_CHANGED;
+		else
+			st = D_UNCHANGED;
+
+		++diff_nodes[st];
+		if (st != D_UNCHANGED) {
+			(void) fprintf(stderr, "%c %s", diff_marks[st],
+			    nn != NO_NODE ? NODE_FMRI(ng, nn) :
+			    NODE_FMRI(og, on));
+			if (st == D_CHANGED &&
+			    ((og->gr_nodes[on].n_flags ^
+			    ng->gr_nodes[nn].n_flags) & N_ENABLED))
+				(void) fputs(ng->gr_nodes[nn].n_flags &
+				    N_ENABLED ? " (enabled)" : " (disabled)",
+				    stderr);
+			(void) fputc('\n', stderr);
+		}
+
+		print_diff_node(og, on, ng, nn, st);
+		diff_node_edges(og, on, ng, nn);
+	}
+
+	(void) printf("}\n");
+
+	for (d = 0; d < 2; ++d) {
+		const uint32_t *counts = d == 0 ? diff_nodes : diff_edges;
+
+		(void) fprintf(stderr, "%s: %u %s, %u %s, %u %s, %u %s\n",
+		    d == 0 ? "nodes" : "edges",
+		    counts[D_ADDED], diff_names[D_ADDED],
+		    counts[D_REMOVED], diff_names[D_REMOVED],
+		    counts[D_CHANGED], diff_names[D_CHANGED],
+		    counts[D_UNCHANGED], diff_names[D_UNCHANGED]);
+	}
+}
+
+/*
+ * Level-of-detail views (-D).  Rather than one graph of every instance, the
+ * graph is viewed a level at a time.  Service names form a tree by their
+ * components, so a view of a group of services (e.g., "network/") shows each
+ * group or service directly within it as a single node, and a view of a
+ * service shows its instances.  Nodes outside the view which have edges to or
+ * from it are shown too, collapsed into the largest group or service which
+ * doesn't contain the view.  Edges between the same two nodes are collapsed
+ * into one, labeled with their number.
+ *
+ * Each collapsed node links to its own view, in the file named by lod_file(),
+ * so the views can be rendered separately as they're visited (see the
+ * Makefile) and each needs only a small graph.
+ */
+
+struct lod_unit {
+	uint32_t	lu_node;	/* node, for instances */
+	uint32_t	lu_ninsts;	/* instances within, if in the view */
+	uint32_t	lu_nenabled;
+	int		lu_inview;
+	int		lu_used;	/* has an edge */
+};
+
+struct lod_pair {
+	uint32_t	lp_from, lp_to;
+	uint32_t	lp_dg;		/* port, for edges from instances */
+	uint32_t	lp_key;		/* lp_dg, or NO_NODE if from a group */
+	uint32_t	lp_count;
+	int		lp_weight;
+	grouping_t	lp_grouping;
+};
+
+/* Map from unit names to ids. */
+static struct graph lod_names;
+static struct lod_unit *lod_units;
+static uint32_t lod_nunits, lod_unitcap;
+static struct lod_pair *lod_pairs;
+static uint32_t lod_npairs, lod_paircap;
+static uint32_t *lod_unit_of;	/* unit of each node, or NO_NODE */
+
+/* Open-addressed hash of the pairs' ids, NO_NODE where free. */
+static uint32_t *lod_pairhash;
+static uint32_t lod_pairhashsz;	/* power of two */
+
+static uint32_t
+lod_pair_slot(uint32_t from, uint32_t key, uint32_t to)
+{
+	uint32_t i, p;
+
+	for (i = (from * 2654435761U ^ key * 2246822519U ^ to * 3266489917U) &
+	    (lod_pairhashsz - 1); (p = lod_pairhash[i]) != NO_NODE;
+	    i = (i + 1) & (lod_pairhashsz - 1)) {
+		if (lod_pairs[p].lp_from == from &&
+		    lod_pairs[p].lp_key == key && lod_pairs[p].lp_to == to)
+			break;
+	}
+
+	return (i);
+}
+
+/*
+ * Return the id of the pair of units from from (through dependency group key,
+ * if it's an instance, or NO_NODE) to to, adding it, with a count of 0, if
+ * there isn't one.
+ */
+static uint32_t
+lod_pair(uint32_t from, uint32_t key, uint32_t to)
+{
+	struct lod_pair *pp;
+	uint32_t i;
+
+	if (2 * (lod_npairs + 1) > lod_pairhashsz) {
+		lod_pairhashsz = lod_pairhashsz == 0 ? 1024 :
+		    2 * lod_pairhashsz;
+		free(lod_pairhash);
+		lod_pairhash = safe_realloc(NULL,
+		    lod_pairhashsz * sizeof (uint32_t));
+		for (i = 0; i < lod_pairhashsz; ++i)
+			lod_pairhash[i] = NO_NODE;
+		for (i = 0; i < lod_npairs; ++i) {
+			pp = &lod_pairs[i];
+			lod_pairhash[lod_pair_slot(pp->lp_from, pp->lp_key,
+			    pp->lp_to)] = i;
+		}
+	}
+
+	i = lod_pair_slot(from, key, to);
+	if (lod_pairhash[i] != NO_NODE)
+		return (lod_pairhash[i]);
+
+	grow(&lod_pairs, &lod_paircap, lod_npairs, 1, sizeof (*pp));
+	pp = &lod_pairs[lod_npairs];
+	pp->lp_from = from;
+	pp->lp_to = to;
+	pp->lp_key = key;
+	pp->lp_count = 0;
+
+	return (lod_pairhash[i] = lod_npairs++);
+}
+
+/*
+ * Set *lenp to the length of the service name in fmri and return a pointer
+ * to it.
+ */
+static const char *
+service_name(const char *fmri, size_t *lenp)
+{
+	const char *colon;
+
+	if (strncmp(fmri, "svc:/", sizeof ("svc:/") - 1) == 0)
+		fmri += sizeof ("svc:/") - 1;
+
+	colon = strchr(fmri, ':');
+	*lenp = colon != NULL ? (size_t)(colon - fmri) : strlen(fmri);
+	return (fmri);
+}
+
+/*
+ * Fill in buf with the name of the file for the view of name: "lod" for the
+ * top, followed by each component of name prefixed with "@".  The @s are
+ * turned back into slashes by -D.
+ */
+static void
+lod_file(const char *name, char *buf, size_t bufsz)
+{
+	char *cp;
+
+	(void) snprintf(buf, bufsz, "lod%s%s.svg", name[0] != '\0' ? "@" : "",
+	    name);
+	for (cp = buf; *cp != '\0'; ++cp) {
+		if (*cp == '/')
+			*cp = '@';
+	}
+}
+
+static uint32_t
+lod_unit(const char *name, uint32_t node)
+{
+	struct lod_unit *up;
+	uint32_t u;
+
+	u = node_lookup(&lod_names, name, 1);
+	if (u < lod_nunits)
+		return (u);
+
+	grow(&lod_units, &lod_unitcap, lod_nunits, 1, sizeof (*up));
+	up = &lod_units[lod_nunits++];
+	up->lu_node = node;
+	up->lu_ninsts = 0;
+	up->lu_nenabled = 0;
+	up->lu_inview = 0;
+	up->lu_used = 0;
+
+	return (u);
+}
+
+/*
+ * Return the unit node n is shown as in the view of view (which ends in a
+ * slash unless it's a service, or is empty for the top).
+ */
+static uint32_t
+lod_unit_for(const struct graph *g, uint32_t n, const char *view, int svcview)
+{
+	char name[QUERY_MAX];
+	const char *sname, *slash;
+	size_t slen, vlen, common, i;
+	uint32_t u;
+
+	if (lod_unit_of[n] != NO_NODE)
+		return (lod_unit_of[n]);
+
+	sname = service_name(NODE_FMRI(g, n), &slen);
+	vlen = strlen(view);
+
+	if (svcview && slen == vlen && strncmp(sname, view, slen) == 0) {
+		u = lod_unit(NODE_FMRI(g, n), n);
+		lod_units[u].lu_inview = 1;
+		return (lod_unit_of[n] = u);
+	}
+
+	/* The whole components sname has in common with the view. */
+	for (i = common = 0; i < slen && i < vlen && sname[i] == view[i]; ++i) {
+		if (sname[i] == '/')
+			common = i + 1;
+	}
+	if (svcview && i == vlen && i < slen && sname[i] == '/')
+		common = i + 1;
+
+	/* Plus one more, which is a group unless it's the last. */
+	slash = memchr(sname + common, '/', slen - common);
+	if (slash != NULL)
+		slen = slash - sname + 1;
+
+	(void) snprintf(name, sizeof (name), "%.*s", (int)slen, sname);
+	u = lod_unit(name, NO_NODE);
+	if (!svcview && common == vlen)
+		lod_units[u].lu_inview = 1;
+
+	return (lod_unit_of[n] = u);
+}
+
+/*
+ * Print the view of name, which is a group of services if it ends in "/" or
+ * "@", a service otherwise, or the top if it's "/" or "@".  Returns the exit
+ * status.
+ */
+static int
+print_lod(const struct graph *g, const char *name, const char *size)
+{
+	char view[QUERY_MAX], parent[QUERY_MAX];
+	char file[QUERY_MAX + 16];
+	char *cp;
+	uint32_t i, u, e;
+	size_t vlen;
+	int svcview, nshown = 0;
+
+	(void) strlcpy(view, name, sizeof (view));
+	for (cp = view; *cp != '\0'; ++cp) {
+		if (*cp == '@')
+			*cp = '/';
+	}
+	if (strncmp(view, "svc:/", sizeof ("svc:/") - 1) == 0)
+		(void) memmove(view, view + sizeof ("svc:/") - 1,
+		    strlen(view + sizeof ("svc:/") - 1) + 1);
+	if (strcmp(view, "/") == 0)
+		view[0] = '\0';
+	vlen = strlen(view);
+	svcview = (vlen != 0 && view[vlen - 1] != '/');
+
+	lod_unit_of = safe_realloc(NULL, (g->gr_nnodes + 1) *
+	    sizeof (uint32_t));
+	for (i = 0; i < g->gr_nnodes; ++i)
+		lod_unit_of[i] = NO_NODE;
+
+	for (i = 0; i < g->gr_nnodes; ++i) {
+		uint32_t n = g->gr_byname[i];
+
+		if (!(g->gr_nodes[n].n_flags & N_CRAWLED))
+			continue;
+
+		u = lod_unit_for(g, n, view, svcview);
+		if (!lod_units[u].lu_inview)
+			continue;
+
+		++lod_units[u].lu_ninsts;
+		if (g->gr_nodes[n].n_flags & N_ENABLED)
+			++lod_units[u].lu_nenabled;
+		++nshown;
+	}
+
+	if (nshown == 0) {
+		(void) fprintf(stderr, "%s: no such service or group\n", name);
+		return (1);
+	}
+
+	/* Collapse the edges to and from the view. */
+	for (e = 0; e < g->gr_nedges; ++e) {
+		const struct edge *ep = &g->gr_edges[e];
+		const struct depgroup *dgp = &g->gr_dgs[ep->e_dg];
+		uint32_t from, to, p;
+		struct lod_pair *pp;
+		int weight;
+
+		from = lod_unit_for(g, dgp->dg_node, view, svcview);
+		to = lod_unit_for(g, ep->e_to, view, svcview);
+
+		if (from == to ||
+		    (!lod_units[from].lu_inview && !lod_units[to].lu_inview))
+			continue;
+
+		p = lod_pair(from,
+		    lod_units[from].lu_node != NO_NODE ? ep->e_dg : NO_NODE,
+		    to);
+		pp = &lod_pairs[p];
+		weight = groupings[dgp->dg_grouping].weight;
+
+		if (pp->lp_count == 0) {
+			pp->lp_dg = ep->e_dg;
+			pp->lp_weight = weight;
+			pp->lp_grouping = dgp->dg_grouping;
+			lod_units[from].lu_used = 1;
+			lod_units[to].lu_used = 1;
+		}
+
+		++pp->lp_count;
+		if (weight > pp->lp_weight || (weight == pp->lp_weight &&
+		    dgp->dg_grouping < pp->lp_grouping)) {
+			pp->lp_weight = weight;
+			pp->lp_grouping = dgp->dg_grouping;
+		}
+	}
+
+	(void) printf("digraph scf {\n");
+	(void) printf("label=\"%s\\n%s\";\n", GSTR(g, g->gr_label),
+	    vlen != 0 ? view : "all services");
+	print_graph_settings(size);
+	(void) putchar('\n');
+
+	if (vlen != 0) {
+		/* A link to the enclosing view. */
+		for (i = vlen - 1; i > 0 && view[i - 1] != '/'; --i)
+			;
+		(void) snprintf(parent, sizeof (parent), "%.*s", (int)i, view);
+		lod_file(parent, file, sizeof (file));
+		(void) printf("\"..\" [shape=plaintext,URL=\"%s\","
+		    "label=\"up to %s\"];\n\n", file,
+		    i != 0 ? parent : "all services");
+	}
+
+	for (u = 0; u < lod_nunits; ++u) {
+		const struct lod_unit *up = &lod_units[u];
+		const char *uname = GSTR(&lod_names,
+		    lod_names.gr_nodes[u].n_fmri);
+		const char * const *colors;
+
+		if (!up->lu_inview && !up->lu_used)
+			continue;
+
+		if (up->lu_node != NO_NODE) {
+			const struct node *np = &g->gr_nodes[up->lu_node];
+			uint32_t d;
+
+			/* An instance, in a service's view. */
+			allpgs[0] = '\0';
+			for (d = np->n_dg; d < np->n_dg + np->n_ndgs; ++d)
+				add_dep(GSTR(g, g->gr_dgs[d].dg_name));
+			if (allpgs[0] != '\0')
+				allpgs[strlen(allpgs) - 1] = '\0';
+
+			print_service_node(uname, uname + sizeof ("svc:/") - 1,
+			    allpgs, state_color(choose_color(uname,
+			    np->n_flags & N_ENABLED), N_STATE(np->n_flags)));
+			continue;
+		}
+
+		colors = choose_color(uname, up->lu_inview &&
+		    up->lu_nenabled != 0);
+		lod_file(uname, file, sizeof (file));
+
+		(void) printf("\"%s\" [shape=%s,color=\"%s\","
+		    "style=\"filled%s\",fillcolor=\"%s\",fontcolor=\"%s\","
+		    "URL=\"%s\",", uname,
+		    uname[strlen(uname) - 1] == '/' ? "folder" : "box",
+		    colors[0], up->lu_inview ? "" : ",dashed", colors[1],
+		    colors[0], file);
+		if (up->lu_inview)
+			(void) printf("label=\"%s\\n%u instance%s, %u "
+			    "enabled\"];\n", uname, up->lu_ninsts,
+			    up->lu_ninsts == 1 ? "" : "s", up->lu_nenabled);
+		else
+			(void) printf("label=\"%s\"];\n", uname);
+	}
+
+	(void) putchar('\n');
+
+	for (i = 0; i < lod_npairs; ++i) {
+		const struct lod_pair *pp = &lod_pairs[i];
+		const char *from = GSTR(&lod_names,
+		    lod_names.gr_nodes[pp->lp_from].n_fmri);
+		const char *to = GSTR(&lod_names,
+		    lod_names.gr_nodes[pp->lp_to].n_fmri);
+		const char *gopts = groupings[pp->lp_grouping].opts;
+		char opts[100];
+		uint32_t c, width = 1;
+
+		for (c = pp->lp_count; c > 1; c /= 2)
+			++width;
+
+		if (pp->lp_count > 1)
+			(void) snprintf(opts, sizeof (opts),
+			    "%s%slabel=\"%u\",penwidth=%u", gopts,
+			    gopts[0] != '\0' ? "," : "", pp->lp_count, width);
+		else
+			(void) strlcpy(opts, gopts, sizeof (opts));
+
+		if (lod_units[pp->lp_from].lu_node != NO_NODE)
+			print_dependency(from,
+			    GSTR(g, g->gr_dgs[pp->lp_dg].dg_name), to, opts,
+			    pp->lp_weight);
+		else
+			(void) printf("\"%s\" -> \"%s\" [%s%sweight=%d];\n",
+			    from, to, opts, opts[0] != '\0' ? "," : "",
+			    pp->lp_weight);
+	}
+
+	(void) printf("}\n");
+	return (0);
+}
+
+/*
+ * Data for the HTML viewer (-H).  The viewer (viewer.html, into which the
+ * Makefile embeds the SVG rendering of the graph) only needs the FMRIs up
+ * front, for searching, so nodes.js holds just those, sorted.  The details of
+ * each instance are in shards of HTML_SHARD instances, node-<n>.js holding
+ * those at positions n * HTML_SHARD and up, which the viewer loads as they're
+ * needed.  Both are JavaScript calling back into the viewer, rather than
+ * JSON, so they can be loaded from file: URLs.
+ */
+
+#define	HTML_SHARD	256
+
+static void
+print_js_string(FILE *fp, const char *str)
+{
+	(void) putc('"', fp);
+	for (; *str != '\0'; ++str) {
+		if (*str == '"' || *str == '\\')
+			(void) putc('\\', fp);
+		if ((uint8_t)*str < ' ')
+			(void) fprintf(fp, "\\u%04x", (uint8_t)*str);
+		else
+			(void) putc(*str, fp);
+	}
+	(void) putc('"', fp);
+}
+
+static FILE *
+html_open(const char *dir, const char *file, char *path, size_t pathsz)
+{
+	FILE *fp;
+
+	(void) snprintf(path, pathsz, "%s/%s", dir, file);
+	if ((fp = fopen(path, "w")) == NULL) {
+		perror(path);
+		exit(1);
+	}
+
+	return (fp);
+}
+
+static void
+html_close(FILE *fp, const char *path)
+{
+	if (ferror(fp) || fclose(fp) != 0) {
+		perror(path);
+		exit(1);
+	}
+}
+
+/*
+ * Print the details of node n: its FMRI, whether it's enabled, its dependency
+ * groups with their groupings and targets, and its dependents.
+ */
+static void
+html_node(FILE *fp, const struct graph *g, uint32_t n)
+{
+	const struct node *np = &g->gr_nodes[n];
+	uint32_t d, e, prev = NO_NODE;
+
+	(void) fputs("{f:", fp);
+	print_js_string(fp, NODE_FMRI(g, n));
+	(void) fprintf(fp, ",c:%d,e:%d,s:\"%s\",g:[",
+	    (np->n_flags & N_CRAWLED) != 0, (np->n_flags & N_ENABLED) != 0,
+	    state_names[N_STATE(np->n_flags)]);
+
+	for (d = np->n_dg; d < np->n_dg + np->n_ndgs; ++d) {
+		const struct depgroup *dgp = &g->gr_dgs[d];
+
+		(void) fputs(d != np->n_dg ? ",[" : "[", fp);
+		print_js_string(fp, GSTR(g, dgp->dg_name));
+		(void) fprintf(fp, ",\"%s\",[",
+		    groupings[dgp->dg_grouping].name);
+		for (e = dgp->dg_edge; e < dgp->dg_edge + dgp->dg_nedges;
+		    ++e) {
+			if (e != dgp->dg_edge)
+				(void) putc(',', fp);
+			print_js_string(fp,
+			    NODE_FMRI(g, g->gr_edges[e].e_to));
+		}
+		(void) fputs("]]", fp);
+	}
+
+	/*
+	 * The edges to n are in edge order, so those from the same node (which
+	 * has several if it depends on n through more than one group) are
+	 * adjacent.  List each dependent once.
+	 */
+	(void) fputs("],d:[", fp);
+	for (e = g->gr_revoff[n]; e < g->gr_revoff[n + 1]; ++e) {
+		const struct edge *ep = &g->gr_edges[g->gr_rev[e]];
+		uint32_t from = g->gr_dgs[ep->e_dg].dg_node;
 
-					print_dependency(fmri, pgname,
-					    dep_fmri, opts, weight + i);
-				}
-			} else {
-				if (enabled && is_enabled(g_inst))
-					weight += 2;
+		if (from == prev)
+			continue;
+		if (prev != NO_NODE)
+			(void) putc(',', fp);
+		print_js_string(fp, NODE_FMRI(g, from));
+		prev = from;
+	}
+	(void) fputs("]}", fp);
+}
+
+/*
+ * Write the viewer's data files to dir, creating it if necessary.
+ */
+static void
+write_html_data(const struct graph *g, const char *dir)
+{
+	char path[MAXPATHLEN], file[32];
+	FILE *fp = NULL;
+	uint32_t i;
+
+	if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+		perror(dir);
+		exit(1);
+	}
 
-				print_dependency(fmri, pgname, depname, opts,
-				    weight);
+	fp = html_open(dir, "nodes.js", path, sizeof (path));
+	(void) fprintf(fp, "scfdot_index(%u, [\n", HTML_SHARD);
+	for (i = 0; i < g->gr_nnodes; ++i) {
+		print_js_string(fp, NODE_FMRI(g, g->gr_byname[i]));
+		(void) fputs(i + 1 < g->gr_nnodes ? ",\n" : "\n", fp);
+	}
+	(void) fputs("]);\n", fp);
+	html_close(fp, path);
+
+	for (i = 0; i < g->gr_nnodes; ++i) {
+		if (i % HTML_SHARD == 0) {
+			if (i != 0) {
+				(void) fputs("]);\n", fp);
+				html_close(fp, path);
 			}
+			(void) snprintf(file, sizeof (file), "node-%u.js",
+			    i / HTML_SHARD);
+			fp = html_open(dir, file, path, sizeof (path));
+			(void) fprintf(fp, "scfdot_shard(%u, [\n",
+			    i / HTML_SHARD);
+		} else {
+			(void) fputs(",\n", fp);
 		}
+
+		html_node(fp, g, g->gr_byname[i]);
 	}
 
-	return (0);
+	if (g->gr_nnodes != 0) {
+		(void) fputs("]);\n", fp);
+		html_close(fp, path);
+	}
+}
+
+/*
+ * Disable-impact simulation.  Given a set of instances to disable, find the
+ * instances whose dependencies would then be unsatisfiable, following the
+ * semantics of each grouping:
+ *
+ *   require_all	unsatisfiable if any dependency FMRI is
+ *   require_any	unsatisfiable if all of the dependency FMRIs are
+ *   optional_all	never (disabled dependencies satisfy it)
+ *   exclude_all	never (disabling can only help)
+ *   restarter		unsatisfiable if the restarter is
+ *
+ * where a dependency FMRI naming a service is unsatisfiable if all of the
+ * service's instances are.  An instance is unsatisfiable if it's disabled or
+ * any of its dependency groups is.  Instances which are already disabled, and
+ * those which consequently can't run, are the baseline; only instances which
+ * the disabling adds to it are reported.
+ *
+ * Each dependency FMRI (for require_any, each dependency group) is an
+ * "entity" with a count of the members which can still run.  Unsatisfiable
+ * instances are kept in a bitset and propagated through the reverse edges
+ * with a worklist, decrementing the counts of the entities they belong to; an
+ * entity reaching zero makes its dependent unsatisfiable.  Every change a
+ * scenario makes is logged so it can be undone, so each scenario costs time
+ * proportional to its effect rather than to the size of the graph.
+ */
+
+static uint64_t *sim_down;	/* bitset of unsatisfiable nodes */
+static uint32_t *sim_cause;	/* edge which made a node unsatisfiable */
+static uint32_t *sim_ent;	/* entity of each edge */
+static uint32_t *sim_live;	/* members of each entity which can run */
+static uint32_t *sim_work;	/* worklist of nodes, then the answer */
+static uint32_t *sim_undo;	/* entities decremented by this scenario */
+static uint32_t sim_nundo;
+
+#define	SIM_DOWN(n)	(sim_down[(n) / 64] & (1ULL << ((n) % 64)))
+
+static int
+sim_propagates(const struct graph *g, uint32_t dg)
+{
+	switch (g->gr_dgs[dg].dg_grouping) {
+	case G_REQUIRE_ALL:
+	case G_REQUIRE_ANY:
+	case G_RESTARTER:
+		return (1);
+
+	default:
+		return (0);
+	}
+}
+
+/*
+ * Mark the first cnt nodes of sim_work unsatisfiable and propagate.  Returns
+ * the number of nodes in sim_work when done.  If undo is set, log the
+ * entities decremented in sim_undo.
+ */
+static uint32_t
+sim_propagate(const struct graph *g, uint32_t cnt, int undo)
+{
+	uint32_t head, i;
+
+	for (i = 0; i < cnt; ++i)
+		sim_down[sim_work[i] / 64] |= 1ULL << (sim_work[i] % 64);
+
+	for (head = 0; head < cnt; ++head) {
+		uint32_t v = sim_work[head];
+
+		for (i = g->gr_revoff[v]; i < g->gr_revoff[v + 1]; ++i) {
+			uint32_t e = g->gr_rev[i];
+			uint32_t dg = g->gr_edges[e].e_dg;
+			uint32_t u = g->gr_dgs[dg].dg_node;
+
+			if (!sim_propagates(g, dg) || SIM_DOWN(u))
+				continue;
+
+			if (undo)
+				sim_undo[sim_nundo++] = sim_ent[e];
+			if (--sim_live[sim_ent[e]] != 0)
+				continue;
+
+			sim_down[u / 64] |= 1ULL << (u % 64);
+			sim_cause[u] = e;
+			sim_work[cnt++] = u;
+		}
+	}
+
+	return (cnt);
+}
+
+/*
+ * Set up the entities and the baseline.
+ */
+static void
+sim_init(const struct graph *g)
+{
+	uint32_t nent = 0, cnt = 0, n, d, e;
+
+	if ((sim_down = calloc(g->gr_nnodes / 64 + 1, sizeof (uint64_t))) ==
+	    NULL) {
+		perror("calloc");
+		exit(1);
+	}
+	sim_cause = safe_realloc(NULL, (g->gr_nnodes + 1) * sizeof (uint32_t));
+	sim_work = safe_realloc(NULL, (g->gr_nnodes + 1) * sizeof (uint32_t));
+	sim_ent = safe_realloc(NULL, (g->gr_nedges + 1) * sizeof (uint32_t));
+	sim_live = safe_realloc(NULL, (g->gr_nedges + 1) * sizeof (uint32_t));
+	sim_undo = safe_realloc(NULL, (g->gr_nedges + 1) * sizeof (uint32_t));
+
+	for (d = 0; d < g->gr_ndgs; ++d) {
+		const struct depgroup *dgp = &g->gr_dgs[d];
+
+		for (e = dgp->dg_edge; e < dgp->dg_edge + dgp->dg_nedges;
+		    ++e) {
+			if (e == dgp->dg_edge ||
+			    (dgp->dg_grouping != G_REQUIRE_ANY &&
+			    !(g->gr_edges[e].e_flags & E_SAMEENT)))
+				sim_live[nent++] = 0;
+			sim_ent[e] = nent - 1;
+			++sim_live[nent - 1];
+		}
+	}
+
+	for (n = 0; n < g->gr_nnodes; ++n) {
+		sim_cause[n] = NO_NODE;
+		if ((g->gr_nodes[n].n_flags & (N_CRAWLED | N_ENABLED)) ==
+		    N_CRAWLED)
+			sim_work[cnt++] = n;
+	}
+
+	(void) sim_propagate(g, cnt, 0);
+}
+
+/*
+ * Print the chain of dependencies which makes n unsatisfiable.
+ */
+static void
+sim_print_reason(const struct graph *g, uint32_t n)
+{
+	(void) fputs(NODE_FMRI(g, n), stdout);
+
+	while (sim_cause[n] != NO_NODE) {
+		const struct edge *ep = &g->gr_edges[sim_cause[n]];
+		const struct depgroup *dgp = &g->gr_dgs[ep->e_dg];
+
+		(void) printf(": %s (%s) -> %s", GSTR(g, dgp->dg_name),
+		    groupings[dgp->dg_grouping].name, NODE_FMRI(g, ep->e_to));
+		n = ep->e_to;
+	}
+
+	(void) puts(" (disabled)");
+}
+
+/*
+ * Disable the instances named in line, separated by spaces or commas, and
+ * print each instance which becomes unsatisfiable as a result, along with the
+ * reason.  Returns 0 on success and -1 if an instance is unknown.
+ */
+static int
+run_scenario(const struct graph *g, char *line)
+{
+	char fmribuf[QUERY_MAX];
+	char *tok;
+	uint32_t cnt = 0, nseeds, n, i;
+	int ret = 0;
+
+	for (tok = strtok(line, " \t,\n"); tok != NULL;
+	    tok = strtok(NULL, " \t,\n")) {
+		if (strncmp(tok, "svc:", sizeof ("svc:") - 1) != 0) {
+			(void) snprintf(fmribuf, sizeof (fmribuf), "svc:/%s",
+			    tok);
+			tok = fmribuf;
+		}
+
+		if ((n = graph_find(g, tok)) == NO_NODE) {
+			(void) fprintf(stderr, "%s: no such instance\n", tok);
+			ret = -1;
+			continue;
+		}
+
+		if (!SIM_DOWN(n)) {
+			sim_down[n / 64] |= 1ULL << (n % 64);
+			sim_work[cnt++] = n;
+		}
+	}
+
+	nseeds = cnt;
+	sim_nundo = 0;
+	cnt = sim_propagate(g, cnt, 1);
+
+	sort_graph = g;
+	qsort(sim_work + nseeds, cnt - nseeds, sizeof (uint32_t), rank_cmp);
+	for (i = nseeds; i < cnt; ++i)
+		sim_print_reason(g, sim_work[i]);
+
+	/* Back to the baseline. */
+	for (i = 0; i < cnt; ++i) {
+		n = sim_work[i];
+		sim_down[n / 64] &= ~(1ULL << (n % 64));
+		sim_cause[n] = NO_NODE;
+	}
+	for (i = 0; i < sim_nundo; ++i)
+		++sim_live[sim_undo[i]];
+
+	return (ret);
+}
+
+/*
+ * Run the scenario in disable, or if disable is "-", each line of the
+ * standard input as a scenario, with a blank line after each answer.
+ * Returns the exit status.
+ */
+static int
+run_scenarios(const struct graph *g, const char *disable)
+{
+	char line[QUERY_MAX];
+	int ret = 0;
+
+	sim_init(g);
+
+	if (strcmp(disable, "-") != 0) {
+		(void) strlcpy(line, disable, sizeof (line));
+		return (run_scenario(g, line) == 0 ? 0 : 1);
+	}
+
+	while (fgets(line, sizeof (line), stdin) != NULL) {
+		if (line[strspn(line, " \t,\n")] == '\0')
+			continue;
+		if (run_scenario(g, line) != 0)
+			ret = 1;
+		(void) putchar('\n');
+	}
+
+	return (ret);
 }
 
 /*
- * If requested, print the legend.  Otherwise print some graph settings and
- * call process_instance() for each service instance in the repository.
+ * If requested, print the legend.  Otherwise crawl the repository (or read
+ * an index file) and print a dot file, save an index file, answer queries, or
+ * simulate disabling instances.
  */
 int
 main(int argc, char **argv)
 {
-	struct utsname utn;
-	int r;
-	time_t now;
-	char timebuf[30];
-	scf_scope_t *scope;
-	scf_service_t *svc;
-	scf_instance_t *inst;
-	scf_iter_t *svciter, *institer;
-	char *svcname;
-
 	char *size = NULL;
 	char *legendfile = NULL;
+	char *indexfile = NULL;
+	char *newindexfile = NULL;
+	char *query = NULL;
+	char *disable = NULL;
+	char *snapshot = NULL;
+	char *view = NULL;
+	char *htmldir = NULL;
+	char *logfile = NULL;
+	char *when = NULL;
+	char *filterexpr = NULL;
+	uint32_t keyint = TLOG_KEYINT;
+	unsigned long long kval;
+	char *end;
+	int update = 0, keyset = 0;
 
 	for (;;) {
-		int o = getopt(argc, argv, "s:l:x:L?");
+		int o = getopt(argc, argv, "s:l:x:Li:I:q:d:c:D:H:T:t:k:uf:S?");
 		if (o == -1)
 			break;
 
@@ -758,6 +5040,27 @@ main(int argc, char **argv)
 					consolidate_rpcbind_svcs = 1;
 					break;
 
+				case 3:
+					dedup_edges = 1;
+					break;
+
+				case 4:
+					merge_edges = 1;
+					break;
+
+				case 5:
+					rank_levels = 1;
+					break;
+
+				case 6:
+					rank_levels = 1;
+					pin_milestones = 1;
+					break;
+
+				case 7:
+					compact = 1;
+					break;
+
 				default:
 					abort();
 				}
@@ -768,81 +5071,86 @@ main(int argc, char **argv)
 			print_legend();
 			return (0);
 
-		case '?':
-			usage(argv[0], optopt == '?', stdout);
+		case 'i':
+			indexfile = optarg;
+			break;
 
-		default:
-			usage(argv[0], 0, stderr);
-		}
-	}
+		case 'I':
+			newindexfile = optarg;
+			break;
 
-	r = uname(&utn);
-	assert(r >= 0);
+		case 'q':
+			query = optarg;
+			break;
 
-	now = time(NULL);
-	(void) cftime(timebuf, NULL, &now);
+		case 'd':
+			disable = optarg;
+			break;
 
-	(void) printf("digraph scf {\n");
-	(void) printf("label=\"%s %s %s\\n%s\";\n", utn.sysname, utn.version,
-	    utn.machine, timebuf);
-	(void) printf("node [shape=box,fontname=\"Helvetica\",fontsize=11];\n");
-	if (size != NULL)
-		(void) printf("size=\"%s\";\n", size);
-	(void) printf("ranksep=\"2\";\n"
-	    "rankdir=LR;\n"
-	    "margin=1;\n");
+		case 'S':
+			print_stats = 1;
+			break;
 
-	if (legendfile != NULL)
-		/*
-		 * The legend is just a node with the given PostScript as its
-		 * shape.  dot will put it on the highest rank.  It usually
-		 * appears too close to another node (system/zones, in
-		 * particular); avoid that with a sufficiently large margin.
-		 * (See expand.awk .)
-		 */
-		(void) printf("\n/* legend */\n"
-		    "legend [shape=epsf,shapefile=\"%s\",label=\"\"];\n",
-		    legendfile);
+		case 'c':
+			snapshot = optarg;
+			break;
 
-	(void) putchar('\n');
+		case 'D':
+			view = optarg;
+			break;
 
-	h = scf_handle_create(SCF_VERSION);
-	if (scf_handle_bind(h) != 0)
-		scfdie();
+		case 'H':
+			htmldir = optarg;
+			break;
 
-	if ((scope = scf_scope_create(h)) == NULL ||
-	    (svc = scf_service_create(h)) == NULL ||
-	    (g_svc = scf_service_create(h)) == NULL ||
-	    (inst = scf_instance_create(h)) == NULL ||
-	    (g_inst = scf_instance_create(h)) == NULL ||
-	    (svciter = scf_iter_create(h)) == NULL ||
-	    (institer = scf_iter_create(h)) == NULL ||
-	    (g_institer = scf_iter_create(h)) == NULL ||
-	    (g_pgiter = scf_iter_create(h)) == NULL ||
-	    (g_valiter = scf_iter_create(h)) == NULL ||
-	    (g_pg = scf_pg_create(h)) == NULL ||
-	    (g_prop = scf_property_create(h)) == NULL ||
-	    (g_val = scf_value_create(h)) == NULL)
-		scfdie();
+		case 'T':
+			logfile = optarg;
+			break;
 
-	if ((max_name_len = scf_limit(SCF_LIMIT_MAX_NAME_LENGTH)) < 0 ||
-	    (max_value_len = scf_limit(SCF_LIMIT_MAX_VALUE_LENGTH)) < 0 ||
-	    (max_fmri_len = scf_limit(SCF_LIMIT_MAX_FMRI_LENGTH)) < 0)
-		scfdie();
+		case 't':
+			when = optarg;
+			break;
+
+		case 'k':
+			kval = strtoull(optarg, &end, 10);
+			if (optarg[0] < '0' || optarg[0] > '9' ||
+			    *end != '\0' || kval == 0 || kval > UINT32_MAX)
+				usage(argv[0], 0, stderr);
+			keyint = (uint32_t)kval;
+			keyset = 1;
+			break;
+
+		case 'u':
+			update = 1;
+			break;
+
+		case 'f':
+			filterexpr = optarg;
+			break;
+
+		case '?':
+			usage(argv[0], optopt == '?', stdout);
+
+		default:
+			usage(argv[0], 0, stderr);
+		}
+	}
+
+	if ((indexfile != NULL && newindexfile != NULL && !update) ||
+	    (when != NULL && (logfile == NULL || indexfile != NULL)) ||
+	    (keyset && (logfile == NULL || when != NULL)) ||
+	    (update && indexfile == NULL && when == NULL) ||
+	    (filterexpr != NULL && (indexfile != NULL || when != NULL)) ||
+	    (query != NULL) + (disable != NULL) + (snapshot != NULL) +
+	    (view != NULL) + (htmldir != NULL) +
+	    (logfile != NULL && when == NULL) > 1)
+		usage(argv[0], 0, stderr);
 
 	allpgs_sz = 100;
 	inetd_svcs_sz = 100;
 	rpcbind_svcs_sz = 100;
 
-	if ((svcname = malloc(max_name_len + 1)) == NULL ||
-	    (instname = malloc(max_name_len + 1)) == NULL ||
-	    (pgname = malloc(max_name_len + 1)) == NULL ||
-	    (depname = malloc(max_value_len + 1)) == NULL ||
-	    (depname_copy = malloc(max_value_len + 1)) == NULL ||
-	    (grouping = malloc(max_value_len + 1)) == NULL ||
-	    (fmri = malloc(max_fmri_len + 1)) == NULL ||
-	    (dep_fmri = malloc(max_fmri_len + 1)) == NULL ||
-	    (allpgs = malloc(allpgs_sz)) == NULL ||
+	if ((allpgs = malloc(allpgs_sz)) == NULL ||
 	    (inetd_svcs = malloc(inetd_svcs_sz)) == NULL ||
 	    (rpcbind_svcs = malloc(rpcbind_svcs_sz)) == NULL) {
 		perror("malloc");
@@ -852,61 +5160,64 @@ main(int argc, char **argv)
 	inetd_svcs[0] = '\0';
 	rpcbind_svcs[0] = '\0';
 
-	if (scf_handle_get_scope(h, SCF_SCOPE_LOCAL, scope) != 0)
-		scfdie();
+	if (filterexpr != NULL)
+		filter_parse(filterexpr);
 
-	if (scf_iter_scope_services(svciter, scope) != 0)
-		scfdie();
+	if (when != NULL) {
+		time_t t = parse_time(when);
 
-	for (;;) {
-		r = scf_iter_next_service(svciter, svc);
-		if (r == 0)
-			break;
-		if (r != 1)
-			scfdie();
+		if (t == (time_t)-1) {
+			(void) fprintf(stderr, "%s: bad time \"%s\"\n",
+			    argv[0], when);
+			exit(2);
+		}
+		tlog_replay(&graph, logfile, t);
+	} else if (indexfile != NULL) {
+		graph_load(&graph, indexfile);
+	} else {
+		crawl(&graph);
+		if (print_stats && filter_root != NO_NODE)
+			report_filter();
+	}
 
-		if (scf_iter_service_instances(institer, svc) != 0)
-			scfdie();
+	if (update)
+		refresh(&graph);
 
-		if (scf_service_get_name(svc, svcname, max_name_len + 1) < 0)
-			scfdie();
+	if (newindexfile != NULL)
+		graph_save(&graph, newindexfile);
 
-		if (strcmp(svcname, "system/svc/restarter") == 0)
-			/* Otherwise this shows up as an unconnected node. */
-			continue;
+	if (logfile != NULL && when == NULL) {
+		tlog_append(&graph, logfile, keyint);
+		return (0);
+	}
 
-		for (;;) {
-			r = scf_iter_next_instance(institer, inst);
-			if (r == 0)
-				break;
-			if (r != 1)
-				scfdie();
+	if (query != NULL)
+		return (run_queries(&graph, query));
 
-			if (process_instance(inst, svcname) != 0) {
-				(void) fputs("process_instance() failed",
-				    stderr);
-				exit(1);
-			}
-		}
+	if (disable != NULL)
+		return (run_scenarios(&graph, disable));
+
+	if (snapshot != NULL) {
+		static struct graph old;
+
+		graph_load(&old, snapshot);
+		print_diff(&old, &graph, size);
+		return (0);
 	}
 
-	if (inetd_svcs[0] != '\0') {
-		print_service_node("inetd_services", inetd_svcs,
-		    "<restarter> restarter", choose_color("network/", 1));
-		print_dependency("inetd_services", "restarter",
-		    "svc:/network/inetd:default", "", 1);
+	if (view != NULL)
+		return (print_lod(&graph, view, size));
+
+	if (htmldir != NULL) {
+		write_html_data(&graph, htmldir);
+		return (0);
 	}
 
-	if (rpcbind_svcs[0] != '\0') {
-		print_service_node("rpcbind_services", rpcbind_svcs,
-		    "<restarter> restarter | <rpcbind> rpcbind",
-		    choose_color("network/", 1));
-		print_dependency("rpcbind_services", "restarter",
-		    "svc:/network/inetd:default", "", 1);
-		print_dependency("rpcbind_services", "rpcbind",
-		    "svc:/network/rpc/bind:default", "", 1);
+	if (newindexfile == NULL) {
+		print_graph(&graph, size, legendfile);
+		if (print_stats)
+			report_stats();
 	}
 
-	(void) printf("}\n");
 	return (0);
 }